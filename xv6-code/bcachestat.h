@@ -0,0 +1,31 @@
+// Buffer cache statistics, as returned by bcachestat(),
+// and the replacement policies bcachectl() can choose.
+#define BC_2Q   0   // scan-resistant 2Q
+#define BC_LRU  1   // least recently used
+
+// Block types, by where the block is on disk.
+#define BT_SUPER  0   // super block
+#define BT_INODE  1   // inode blocks
+#define BT_BITMAP 2   // free bitmap
+#define BT_DATA   3   // file and directory contents
+#define BT_LOG    4   // log header and log blocks
+#define NBTYPE    5
+
+struct btypestat {
+  uint hits;      // Lookups that found the block cached
+  uint misses;    // Lookups that had to recycle a buffer
+  uint evicts;    // Blocks of this type pushed out of the cache
+  uint waits;     // Lookups that found the buffer in use
+  uint writes;    // Blocks written to disk
+};
+
+struct bcachestat {
+  uint hits;      // Totals of the hits and misses below
+  uint misses;
+  uint aheads;    // Blocks read ahead
+  uint nbuf;      // Buffers in the cache
+  uint na1;       // Buffers on the 2Q A1 list
+  uint nghost;    // Blocks remembered on A1out
+  int policy;     // BC_2Q or BC_LRU
+  struct btypestat type[NBTYPE];
+};
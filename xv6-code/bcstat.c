@@ -0,0 +1,106 @@
+// Show buffer cache statistics by block type.
+// With a command, run it and show only what happened
+// while it ran.
+// usage: bcstat [command [args...]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "bcachestat.h"
+
+char *types[NBTYPE] = { "super", "inode", "bitmap", "data", "log" };
+
+// Print n right-justified in a field w wide.
+void
+putnum(uint n, int w)
+{
+  char buf[12];
+  int i;
+
+  i = sizeof(buf) - 1;
+  buf[i] = 0;
+  do {
+    buf[--i] = '0' + n % 10;
+    n /= 10;
+  } while(n > 0 && i > 0);
+  while(w-- > sizeof(buf) - 1 - i)
+    printf(1, " ");
+  printf(1, "%s ", buf + i);
+}
+
+// Return a as a percentage of n, where a <= n.
+uint
+percent(uint a, uint n)
+{
+  if(n == 0)
+    return 0;
+  if(n > 0xffffffff/100)  // a*100 could overflow
+    return a / (n / 100);
+  return a * 100 / n;
+}
+
+// Print one line of the table.
+void
+putline(char *name, struct btypestat *t)
+{
+  uint n;
+  int j;
+
+  printf(1, "%s", name);
+  for(j = strlen(name); j < 8; j++)
+    printf(1, " ");
+  n = t->hits + t->misses;
+  putnum(t->hits, 9);
+  putnum(t->misses, 9);
+  putnum(percent(t->hits, n), 4);
+  putnum(t->evicts, 9);
+  putnum(t->waits, 9);
+  putnum(t->writes, 9);
+  printf(1, "\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct bcachestat before, after;
+  struct btypestat total, *t;
+  int i, pid;
+
+  memset(&before, 0, sizeof(before));
+  if(argc > 1){
+    bcachestat(&before);
+    if((pid = fork()) < 0){
+      printf(2, "bcstat: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      exec(argv[1], argv+1);
+      printf(2, "bcstat: exec %s failed\n", argv[1]);
+      exit();
+    }
+    wait();
+  }
+  bcachestat(&after);
+
+  printf(1, "%d buffers, policy %s, %d on A1, %d ghosts, %d read ahead\n",
+         after.nbuf, after.policy == BC_LRU ? "lru" : "2q",
+         after.na1, after.nghost, after.aheads - before.aheads);
+  printf(1, "TYPE          HITS    MISSES %%HIT   EVICTS     WAITS    WRITES\n");
+  memset(&total, 0, sizeof(total));
+  for(i = 0; i < NBTYPE; i++){
+    t = &after.type[i];
+    t->hits -= before.type[i].hits;
+    t->misses -= before.type[i].misses;
+    t->evicts -= before.type[i].evicts;
+    t->waits -= before.type[i].waits;
+    t->writes -= before.type[i].writes;
+    total.hits += t->hits;
+    total.misses += t->misses;
+    total.evicts += t->evicts;
+    total.waits += t->waits;
+    total.writes += t->writes;
+    putline(types[i], t);
+  }
+  putline("total", &total);
+  exit();
+}
@@ -0,0 +1,91 @@
+// Benchmark harness: a microsecond clock, and a way to run
+// the same work in several processes pinned to their own
+// CPUs for a fixed time.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "time.h"
+
+// Return microseconds since boot.
+uint64
+usecs(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000ULL + t.tv_nsec / 1000;
+}
+
+// Return how many CPUs this process may run on,
+// after allowing it to run on all of them.
+int
+ncpus(void)
+{
+  uint mask;
+  int n;
+
+  setaffinity(0, ~0);
+  mask = setaffinity(0, ~0);
+  for(n = 0; mask; mask >>= 1)
+    n += mask & 1;
+  return n;
+}
+
+// Pin to cpu, wait for the go signal, then call fn for ms
+// milliseconds and report the total it returns on fd.
+static void
+benchworker(int cpu, int ms, int (*fn)(void), int go, int fd)
+{
+  uint64 end;
+  uint n;
+  char c;
+
+  setaffinity(0, 1 << cpu);
+  read(go, &c, 1);
+  n = 0;
+  end = usecs() + ms * 1000ULL;
+  while(usecs() < end)
+    n += fn();
+  write(fd, &n, sizeof(n));
+  exit();
+}
+
+// Run nw processes, the ith pinned to CPU i, that start
+// together and call fn for ms milliseconds.  fn does a
+// batch of work and returns how many operations it did.
+// Sets n[i] to the ith process's count; returns the total.
+uint
+benchrun(int nw, int ms, int (*fn)(void), uint *n)
+{
+  int go[2], res[2], i;
+  uint total;
+
+  if(pipe(go) < 0 || pipe(res) < 0){
+    printf(2, "bench: pipe failed\n");
+    exit();
+  }
+  for(i = 0; i < nw; i++){
+    if(fork() == 0){
+      close(go[1]);
+      close(res[0]);
+      benchworker(i, ms, fn, go[0], res[1]);
+    }
+  }
+  close(go[0]);
+  close(res[1]);
+  close(go[1]);  // start them all
+
+  total = 0;
+  for(i = 0; i < nw; i++){
+    if(read(res[0], &n[i], sizeof(n[i])) != sizeof(n[i])){
+      printf(2, "bench: worker died\n");
+      exit();
+    }
+    total += n[i];
+  }
+  close(res[0]);
+  for(i = 0; i < nw; i++)
+    wait();
+  return total;
+}
@@ -1,21 +1,65 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a set of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 // 
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
+// * To start reading a block that will be wanted soon,
+//     call breadahead.
+// * To get a buffer whose data is all about to be replaced,
+//     call bgetover; it does not read the block from disk.
+// * bread_async and bwrite_async start I/O on a locked buffer
+//     without waiting; call bwait before using the data.
 // * After changing buffer data, call bwrite to write it to disk.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 // 
-// The implementation uses three state flags internally:
-// * B_BUSY: the block has been returned from bread
-//     and has not been passed back to brelse.  
+// A buffer's mutex is held from bread to brelse, and
+// b->refcnt counts the processes holding it or waiting for
+// it; a buffer is only recycled when refcnt is zero.
+//
+// Cached blocks are found through a hash table on (dev,
+// blockno) with a spinlock per bucket, so lookups of
+// different blocks do not contend.
+//
+// Buffers are recycled by the 2Q policy (Johnson and
+// Shasha, VLDB 1994), so that reading through a large file
+// does not flush the blocks in steady use.  A block read in
+// goes on the A1 list, in FIFO order, and the burst of
+// references right after does not count.  If it is wanted
+// again after falling off A1, while its address is still on
+// the A1out "ghost" list, it is read into the Am list,
+// which is kept in LRU order.  A1 is recycled from first as
+// long as it has more than a quarter of the buffers.  Blocks
+// read just once pass through A1 without disturbing Am.
+// bcachectl() can switch to plain LRU, with every block on
+// Am, for comparison.  Buffers holding no block are on a
+// free list and are taken before any other.
+//
+// bcache.lock protects the lists, A1out and the statistics,
+// and serializes recycling; it is taken before any bucket
+// lock, and only its holder may hold more than one bucket
+// lock at once.
+//
+// Beyond the NBUF buffers built in, the cache grows a page
+// of buffers at a time, when a miss finds the free list
+// empty, up to 1/BCACHEFRAC of memory (or the limit set by
+// bcachectl()) and as long as 1/BRESERVE of memory stays
+// free.  A page holds only the buf structures; their
+// BSIZE-byte blocks are carved from BDATAPAGES more pages.
+// When kalloc() runs out of memory, bshrink() gives back
+// pages all of whose buffers are unused and clean.
+//
+// Hits, misses, evictions, lookups that find the buffer in
+// use, and writes are counted per CPU and per block type
+// (blocktype() in fs.c), for bcachestat().
+//
+// The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
@@ -23,117 +67,764 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
 #include "spinlock.h"
+#include "mutex.h"
+#include "fs.h"
 #include "buf.h"
+#include "bcachestat.h"
+
+#define NBUCKET   2039  // hash buckets; prime
+#define NGHOST    4096  // most blocks remembered on A1out
+#define NGBUCKET  1021  // A1out hash buckets; prime
+#define BCACHEFRAC  16  // cache may use 1/BCACHEFRAC of memory
+#define BRESERVE    32  // but grows only if 1/BRESERVE is free
+
+#define BPERPAGE ((PGSIZE - sizeof(void*)) / sizeof(struct buf))
+#define BDATAPAGES ((BPERPAGE*BSIZE + PGSIZE - 1) / PGSIZE)
+
+// Recycling lists.
+enum { QFREE, QA1, QAM };
+
+// A page of buffers.
+struct bufpage {
+  struct bufpage *next;
+  struct buf buf[BPERPAGE];
+};
+
+struct bucket {
+  struct spinlock lock;
+  struct buf *head;
+};
+
+// A block recently recycled from A1.
+struct ghost {
+  uint dev;     // -1 if no longer remembered
+  uint blockno;
+  struct ghost *hnext;
+};
 
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
+  uchar data[NBUF][BSIZE];
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+  // Recycling lists, through prev/next; the buffer at
+  // head.next is the one added or used most recently.
+  struct buf free;
+  struct buf a1;
+  struct buf am;
+  uint nbuf;      // buffers in all
+  uint na1;       // buffers on a1
+  int policy;     // BC_2Q or BC_LRU
+
+  // A1out: a ring of ghosts, oldest first, and a hash
+  // table to find them.  Forgotten ones keep their slots.
+  struct ghost ghost[NGHOST];
+  struct ghost *ghash[NGBUCKET];
+  uint gfirst;
+  uint nghost;
+
+  struct bucket bucket[NBUCKET];
+
+  struct bufpage *pages;  // pages allocated so far
+  uint npages;
+  int maxpages;           // limit set by bcachectl(), or -1
+
+  // Statistics, per CPU.
+  struct {
+    uint aheads;
+    struct btypestat type[NBTYPE];
+  } stat[NCPU];
 } bcache;
 
+// Put b at the front of list q.  Caller must hold bcache.lock.
+static void
+bpush(struct buf *b, int q)
+{
+  struct buf *head;
+
+  head = q == QFREE ? &bcache.free : q == QA1 ? &bcache.a1 : &bcache.am;
+  b->queue = q;
+  if(q == QA1)
+    bcache.na1++;
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+}
+
+// Take b off its list.  Caller must hold bcache.lock.
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  if(b->queue == QA1)
+    bcache.na1--;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *h;
 
+  if(BSIZE > PGSIZE || PGSIZE % BSIZE != 0)
+    panic("binit: BSIZE");
   initlock(&bcache.lock, "bcache");
+  for(h = bcache.bucket; h < bcache.bucket+NBUCKET; h++)
+    initlock(&h->lock, "bcache.bucket");
 
-//PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  bcache.free.prev = bcache.free.next = &bcache.free;
+  bcache.a1.prev = bcache.a1.next = &bcache.a1;
+  bcache.am.prev = bcache.am.next = &bcache.am;
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+    initmutex(&b->lock, "buffer");
+    b->data = bcache.data[b - bcache.buf];
+    b->dev = -1;  // in no bucket
+    bpush(b, QFREE);
+  }
+  bcache.nbuf = NBUF;
+  bcache.policy = BC_2Q;
+  bcache.maxpages = -1;
+}
+
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(blockno ^ (dev << 24)) % NBUCKET];
+}
+
+// Return the buffer for blockno on device dev in bucket h,
+// or 0.  Caller must hold h->lock.
+static struct buf*
+bfind(struct bucket *h, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = h->head; b; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Remove b from bucket h.  Caller must hold h->lock.
+static void
+bunhash(struct bucket *h, struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &h->head; *pp != b; pp = &(*pp)->hnext)
+    ;
+  *pp = b->hnext;
+}
+
+//PAGEBREAK!
+// A1out.  Caller must hold bcache.lock.
+
+static struct ghost**
+ghash(uint dev, uint blockno)
+{
+  return &bcache.ghash[(blockno ^ (dev << 24)) % NGBUCKET];
+}
+
+// Forget the oldest ghost.
+static void
+gdrop(void)
+{
+  struct ghost *g, **pp;
+
+  g = &bcache.ghost[bcache.gfirst];
+  if(g->dev != -1){
+    for(pp = ghash(g->dev, g->blockno); *pp != g; pp = &(*pp)->hnext)
+      ;
+    *pp = g->hnext;
+  }
+  bcache.gfirst = (bcache.gfirst + 1) % NGHOST;
+  bcache.nghost--;
+}
+
+// Remember blockno on dev, just recycled from A1.
+// A1out holds as many blocks as half the buffers.
+static void
+gadd(uint dev, uint blockno)
+{
+  struct ghost *g, **h;
+
+  while(bcache.nghost > 0 &&
+        (bcache.nghost >= NGHOST || bcache.nghost >= bcache.nbuf/2))
+    gdrop();
+  g = &bcache.ghost[(bcache.gfirst + bcache.nghost) % NGHOST];
+  bcache.nghost++;
+  g->dev = dev;
+  g->blockno = blockno;
+  h = ghash(dev, blockno);
+  g->hnext = *h;
+  *h = g;
+}
+
+// Is blockno on dev on A1out?  If so, forget it.
+static int
+gfind(uint dev, uint blockno)
+{
+  struct ghost *g, **pp;
+
+  for(pp = ghash(dev, blockno); (g = *pp) != 0; pp = &g->hnext){
+    if(g->dev == dev && g->blockno == blockno){
+      *pp = g->hnext;
+      g->dev = -1;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+//PAGEBREAK!
+// Growing and recycling.
+
+// How many pages of buffers may the cache have?
+static uint
+bmaxpages(void)
+{
+  uint total, free;
+
+  if(bcache.maxpages >= 0)
+    return bcache.maxpages;
+  kmeminfo(&total, &free);
+  return total / BCACHEFRAC / (1 + BDATAPAGES);
+}
+
+// Free page p and the pages holding its buffers' data.
+static void
+bfreepage(struct bufpage *p)
+{
+  struct buf *b;
+
+  for(b = p->buf; b < p->buf+BPERPAGE; b++)
+    if(b->data && (uint)b->data % PGSIZE == 0)
+      kfree((char*)b->data);
+  kfree((char*)p);
+}
+
+// Allocate a page for more buffers, and the pages for
+// their data, if the cache may grow.
+// Called without locks, since kalloc() may call bshrink().
+static struct bufpage*
+bnewpage(void)
+{
+  struct bufpage *p;
+  uint total, free;
+  char *d;
+  int i;
+
+  kmeminfo(&total, &free);
+  if(bcache.npages >= bmaxpages() ||
+     free < total / BRESERVE + 1 + BDATAPAGES)
+    return 0;
+  if((p = (struct bufpage*)kalloc()) == 0)
+    return 0;
+  d = 0;
+  for(i = 0; i < BPERPAGE; i++){
+    if(i*BSIZE % PGSIZE == 0 && (d = kalloc()) == 0){
+      while(i < BPERPAGE)
+        p->buf[i++].data = 0;
+      bfreepage(p);
+      return 0;
+    }
+    p->buf[i].data = (uchar*)d + i*BSIZE % PGSIZE;
+  }
+  return p;
+}
+
+// Add the buffers in page p to the free list, unless
+// the cache has grown meanwhile.
+// Caller must hold bcache.lock.
+static void
+baddpage(struct bufpage *p)
+{
+  struct buf *b;
+
+  if(bcache.npages >= bmaxpages()){
+    bfreepage(p);
+    return;
+  }
+  for(b = p->buf; b < p->buf+BPERPAGE; b++){
+    initmutex(&b->lock, "buffer");
     b->dev = -1;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->flags = 0;
+    b->refcnt = 0;
+    bpush(b, QFREE);
   }
+  p->next = bcache.pages;
+  bcache.pages = p;
+  bcache.npages++;
+  bcache.nbuf += BPERPAGE;
+}
+
+// If b is unused and clean, take it out of its bucket
+// and return 1.  Caller must hold bcache.lock and h->lock.
+static int
+btake(struct buf *b, struct bucket *h)
+{
+  struct bucket *oh;
+  int ok;
+
+  oh = bhash(b->dev, b->blockno);
+  if(oh != h)
+    acquire(&oh->lock);
+  ok = b->refcnt == 0 && (b->flags & B_DIRTY) == 0;
+  if(ok)
+    bunhash(oh, b);
+  if(oh != h)
+    release(&oh->lock);
+  return ok;
 }
 
-// Look through buffer cache for sector on device dev.
-// If not found, allocate fresh block.
-// In either case, return B_BUSY buffer.
+// Take a buffer from the end of list q, or return 0.
 static struct buf*
-bget(uint dev, uint sector)
+bscan(struct buf *q, struct bucket *h)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
+  for(b = q->prev; b != q; b = b->prev)
+    if(btake(b, h))
+      return b;
+  return 0;
+}
+
+// Recycle a buffer for blockno on device dev, putting it
+// in bucket h, or return 0 if every buffer is in use.
+// Caller must hold bcache.lock and h->lock.
+static struct buf*
+brecycle(struct bucket *h, uint dev, uint blockno)
+{
+  struct buf *b;
+  int a1first, q;
+
+  b = 0;
+  if(bcache.free.next != &bcache.free)
+    b = bcache.free.next;
+  a1first = bcache.na1 > bcache.nbuf/4 || bcache.policy == BC_LRU;
+  if(b == 0 && a1first)
+    b = bscan(&bcache.a1, h);
+  if(b == 0)
+    b = bscan(&bcache.am, h);
+  if(b == 0 && !a1first)
+    b = bscan(&bcache.a1, h);
+  if(b == 0)
+    return 0;
+  if(b->dev != -1)
+    bcache.stat[cpu - cpus].type[b->type].evicts++;
+
+  q = QAM;
+  if(bcache.policy == BC_2Q && !gfind(dev, blockno))
+    q = QA1;
+  if(b->queue == QA1 && bcache.policy == BC_2Q)
+    gadd(b->dev, b->blockno);
+  bunlink(b);
+  b->dev = dev;
+  b->blockno = blockno;
+  b->type = blocktype(dev, blockno);
+  b->flags = 0;
+  b->hnext = h->head;
+  h->head = b;
+  bpush(b, q);
+  return b;
+}
+
+// Look through buffer cache for blockno on device dev.
+// If not found, allocate fresh block.  In either case,
+// take a reference to the buffer and return it.
+// For readahead, return 0 instead if the block is cached
+// already or there is no buffer to spare, and otherwise
+// mark the buffer for an asynchronous read.
+static struct buf*
+bref(uint dev, uint blockno, int ahead)
+{
+  struct buf *b;
+  struct bucket *h;
+  struct bufpage *p;
+  struct btypestat *st;
+  int hit;
+
+  h = bhash(dev, blockno);
+  acquire(&h->lock);
+  if(!(hit = (b = bfind(h, dev, blockno)) != 0)){
+    // Not cached.  Grow the cache if there is no empty
+    // buffer to take (reading the list unlocked is only
+    // a hint), then take the locks in order and look again,
+    // in case another bget() cached it meanwhile.
+    release(&h->lock);
+    p = 0;
+    if(bcache.free.next == &bcache.free)
+      p = bnewpage();
+    acquire(&bcache.lock);
+    if(p)
+      baddpage(p);
+    acquire(&h->lock);
+    if(!(hit = (b = bfind(h, dev, blockno)) != 0))
+      b = brecycle(h, dev, blockno);
+    release(&bcache.lock);
+  }
+
+  if(ahead){
+    if(hit)
+      b = 0;
+    else if(b){
+      b->flags |= B_IO|B_ASYNC;
+      bcache.stat[cpu - cpus].aheads++;
+    }
+  } else if(b == 0)
+    panic("bget: no buffers");
+  else {
+    st = &bcache.stat[cpu - cpus].type[b->type];
+    if(hit)
+      st->hits++;
+    else
+      st->misses++;
+    if(b->refcnt > 0)
+      st->waits++;
+  }
+  if(b)
+    b->refcnt++;
+  release(&h->lock);
+  return b;
+}
+
+// Return the locked buffer for blockno on device dev.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
 
- loop:
-  // Is the sector already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->sector == sector){
-      if(!(b->flags & B_BUSY)){
-        b->flags |= B_BUSY;
-        release(&bcache.lock);
-        return b;
+  b = bref(dev, blockno, 0);
+  mutexlock(&b->lock);
+  return b;
+}
+
+// Lock or unlock the buckets of the buffers on page p that
+// hold blocks.  Caller must hold bcache.lock, which lets it
+// hold more than one bucket lock.
+static void
+bpagelock(struct bufpage *p, int lock)
+{
+  struct buf *b;
+  struct bucket *h;
+
+  for(b = p->buf; b < p->buf+BPERPAGE; b++){
+    if(b->dev == -1)
+      continue;
+    h = bhash(b->dev, b->blockno);
+    if(lock && !holding(&h->lock))
+      acquire(&h->lock);
+    else if(!lock && holding(&h->lock))
+      release(&h->lock);
+  }
+}
+
+// Give back up to n pages of buffers that are all unused
+// and clean.  Called by kalloc() when memory runs out.
+// Returns the number of pages freed.
+int
+bshrink(int n)
+{
+  struct bufpage *p, **pp, *freed;
+  struct buf *b;
+  int busy;
+
+  freed = 0;
+  acquire(&bcache.lock);
+  for(pp = &bcache.pages; (p = *pp) != 0 && n > 0; ){
+    // With all the page's buckets locked, nobody can take
+    // a reference to its buffers: check them all before
+    // evicting any, so that a page that stays keeps its
+    // blocks.
+    bpagelock(p, 1);
+    busy = 0;
+    for(b = p->buf; b < p->buf+BPERPAGE; b++)
+      if(b->dev != -1 && (b->refcnt > 0 || (b->flags & B_DIRTY)))
+        busy = 1;
+    if(!busy){
+      for(b = p->buf; b < p->buf+BPERPAGE; b++){
+        if(b->dev == -1)
+          continue;
+        bcache.stat[cpu - cpus].type[b->type].evicts++;
+        bunhash(bhash(b->dev, b->blockno), b);
       }
-      sleep(b, &bcache.lock);
-      goto loop;
     }
+    bpagelock(p, 0);
+    if(busy){
+      pp = &p->next;
+      continue;
+    }
+    for(b = p->buf; b < p->buf+BPERPAGE; b++)
+      bunlink(b);
+    *pp = p->next;
+    bcache.npages--;
+    bcache.nbuf -= BPERPAGE;
+    p->next = freed;
+    freed = p;
+    n--;
   }
+  release(&bcache.lock);
 
-  // Not cached; recycle some non-busy and clean buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if((b->flags & B_BUSY) == 0 && (b->flags & B_DIRTY) == 0){
-      b->dev = dev;
-      b->sector = sector;
-      b->flags = B_BUSY;
-      release(&bcache.lock);
-      return b;
+  for(n = 0; (p = freed) != 0; n++){
+    freed = p->next;
+    bfreepage(p);
+  }
+  return n;
+}
+
+// Set the replacement policy, if policy is not negative,
+// and the most buffers the cache may have, if nbuf is not
+// negative (0 restores the default).  The NBUF buffers built
+// in always stay, so a smaller limit is an error.  Shrinks
+// the cache at once if it is over the new limit.
+int
+bcachectl(int policy, int nbuf)
+{
+  int over;
+
+  if(policy != BC_2Q && policy != BC_LRU && policy >= 0)
+    return -1;
+  if(nbuf > 0 && nbuf < NBUF)
+    return -1;
+  acquire(&bcache.lock);
+  if(policy >= 0)
+    bcache.policy = policy;
+  if(nbuf == 0)
+    bcache.maxpages = -1;
+  else if(nbuf > 0)
+    bcache.maxpages = nbuf <= NBUF ? 0 : (nbuf - NBUF + BPERPAGE - 1) / BPERPAGE;
+  over = bcache.npages - bmaxpages();
+  release(&bcache.lock);
+  if(over > 0)
+    bshrink(over);
+  return 0;
+}
+
+// Empty the unused, clean buffers on list q and return how
+// many there were.  Caller must hold bcache.lock.
+static int
+binvallist(struct buf *q)
+{
+  struct buf *b, *next;
+  struct bucket *h;
+  int n;
+
+  n = 0;
+  for(b = q->next; b != q; b = next){
+    next = b->next;
+    h = bhash(b->dev, b->blockno);
+    acquire(&h->lock);
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+      bunhash(h, b);
+      b->dev = -1;
+      bunlink(b);
+      bpush(b, QFREE);
+      n++;
+    }
+    release(&h->lock);
+  }
+  return n;
+}
+
+// Empty every buffer that is unused and clean, and forget
+// the blocks on A1out, so that the cache is as if nothing
+// had been read.  Returns the number of buffers emptied.
+int
+bcacheinval(void)
+{
+  int n;
+
+  acquire(&bcache.lock);
+  n = binvallist(&bcache.a1) + binvallist(&bcache.am);
+  memset(bcache.ghash, 0, sizeof(bcache.ghash));
+  bcache.gfirst = bcache.nghost = 0;
+  release(&bcache.lock);
+  return n;
+}
+
+// Report buffer cache statistics.
+void
+bcachestat(struct bcachestat *st)
+{
+  struct btypestat *from, *to;
+  int i, t;
+
+  memset(st, 0, sizeof(*st));
+  acquire(&bcache.lock);
+  for(i = 0; i < ncpu; i++){
+    st->aheads += bcache.stat[i].aheads;
+    for(t = 0; t < NBTYPE; t++){
+      from = &bcache.stat[i].type[t];
+      to = &st->type[t];
+      to->hits += from->hits;
+      to->misses += from->misses;
+      to->evicts += from->evicts;
+      to->waits += from->waits;
+      to->writes += from->writes;
+      st->hits += from->hits;
+      st->misses += from->misses;
     }
   }
-  panic("bget: no buffers");
+  st->nbuf = bcache.nbuf;
+  st->na1 = bcache.na1;
+  st->nghost = bcache.nghost;
+  st->policy = bcache.policy;
+  release(&bcache.lock);
 }
 
-// Return a B_BUSY buf with the contents of the indicated disk sector.
+//PAGEBREAK!
+// Return a locked buf with the contents of the indicated block.
 struct buf*
-bread(uint dev, uint sector)
+bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, sector);
+  b = bget(dev, blockno);
   if(!(b->flags & B_VALID))
     iderw(b);
   return b;
 }
 
-// Write b's contents to disk.  Must be B_BUSY.
+// Return a locked buf for blockno on device dev that the
+// caller will overwrite entirely, without reading it from
+// disk.  The caller must fill all of b->data before
+// releasing it.
+struct buf*
+bgetover(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(b->flags & B_IO)
+    idewaitbuf(b);  // a readahead would overwrite the new data
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Start reading blockno on device dev into the cache,
+// unless it is there already, without waiting.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bref(dev, blockno, 1)) != 0)
+    idesubmit(b);
+}
+
+// Drop the reference breadahead() took, once the read is
+// done.  Called by the disk driver, perhaps in an interrupt.
+void
+bdone(struct buf *b)
+{
+  struct bucket *h;
+
+  h = bhash(b->dev, b->blockno);
+  acquire(&h->lock);
+  b->refcnt--;
+  release(&h->lock);
+}
+
+// Count a write of b.
+static void
+bcountwrite(struct buf *b)
+{
+  pushcli();
+  bcache.stat[cpu - cpus].type[b->type].writes++;
+  popcli();
+}
+
+// Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
-  if((b->flags & B_BUSY) == 0)
+  if(!holdingmutex(&b->lock))
     panic("bwrite");
+  bcountwrite(b);
   b->flags |= B_DIRTY;
   iderw(b);
 }
 
-// Release a B_BUSY buffer.
-// Move to the head of the MRU list.
+// Like bread, but return as soon as the read is started,
+// so that several can be under way at once.  Call bwait
+// before using the data.
+struct buf*
+bread_async(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(!(b->flags & (B_VALID|B_IO))){
+    b->flags |= B_IO;
+    idesubmit(b);
+  }
+  return b;
+}
+
+// Like bwrite, but return as soon as the write is started.
+// b stays locked; call bwait (or brelse) when done with it.
 void
-brelse(struct buf *b)
+bwrite_async(struct buf *b)
 {
-  if((b->flags & B_BUSY) == 0)
-    panic("brelse");
+  if(!holdingmutex(&b->lock))
+    panic("bwrite_async");
+  if(b->flags & B_IO)
+    panic("bwrite_async: busy");
+  bcountwrite(b);
+  b->flags |= B_DIRTY|B_IO;
+  idesubmit(b);
+}
 
-  acquire(&bcache.lock);
+// Wait for the I/O started on locked buffer b to finish.
+void
+bwait(struct buf *b)
+{
+  if(!holdingmutex(&b->lock))
+    panic("bwait");
+  idewaitbuf(b);
+}
 
-  b->next->prev = b->prev;
-  b->prev->next = b->next;
-  b->next = bcache.head.next;
-  b->prev = &bcache.head;
-  bcache.head.next->prev = b;
-  bcache.head.next = b;
+// Release a locked buffer.
+// Move it to the front of Am if it is there and unused.
+void
+brelse(struct buf *b)
+{
+  struct bucket *h;
+  int move;
 
-  b->flags &= ~B_BUSY;
-  wakeup(b);
+  if(!holdingmutex(&b->lock))
+    panic("brelse");
 
-  release(&bcache.lock);
-}
+  // B_IO is set by the holder or before anyone could hold
+  // b, and only the disk driver clears it, so it cannot be
+  // seen clear too early.
+  if(b->flags & B_IO)
+    idewaitbuf(b);
+  mutexunlock(&b->lock);
 
+  // A1 stays in FIFO order.  A buffer on Am that loses its
+  // last reference moves to the front, and that must happen
+  // before refcnt drops to 0: bshrink() may then free its
+  // page.  refcnt and the front of Am are read unlocked as
+  // a hint, so that a buffer still in use or already at the
+  // front need not take bcache.lock; it is taken before the
+  // bucket lock, as usual.
+  h = bhash(b->dev, b->blockno);
+  move = b->queue == QAM && b->refcnt == 1 && bcache.am.next != b;
+  if(move)
+    acquire(&bcache.lock);
+  acquire(&h->lock);
+  if(--b->refcnt == 0 && move){
+    bunlink(b);
+    bpush(b, QAM);
+  }
+  release(&h->lock);
+  if(move)
+    release(&bcache.lock);
+}
@@ -1,13 +1,18 @@
 struct buf {
   int flags;
   uint dev;
-  uint sector;
-  struct buf *prev; // LRU cache list
+  uint blockno;
+  int type;              // BT_* block type, for statistics
+  struct mutex lock;     // held from bread to brelse
+  uint refcnt;           // users holding or waiting for lock
+  struct buf *hnext;     // hash bucket chain
+  int queue;             // which recycling list
+  struct buf *prev;      // recycling list
   struct buf *next;
   struct buf *qnext; // disk queue
-  uchar data[512];
+  uchar *data;           // BSIZE bytes
 };
-#define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
-
+#define B_IO    0x8  // buffer is queued for or at the disk
+#define B_ASYNC 0x10 // nobody waits for the request; see bdone
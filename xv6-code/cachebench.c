@@ -0,0 +1,156 @@
+// Buffer cache replacement benchmark.  With the cache held
+// to its NBUF built-in buffers (or more, if asked),
+// alternates reading through a file larger than that with
+// metadata-heavy work on a set of small files (stat, open,
+// read, close), under LRU and under 2Q, and prints the hit
+// rate of the metadata work and overall.  Under LRU each
+// scan flushes the small files' blocks.
+// usage: cachebench [buffers [rounds]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "param.h"
+#include "bcachestat.h"
+
+#define NSMALL 30
+#define BIGSZ  (120*BSIZE)
+
+char buf[512];
+char name[] = "cbdir/f00";
+
+void
+create(char *path, int n)
+{
+  int fd, m;
+
+  if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+    printf(2, "cachebench: cannot create %s\n", path);
+    exit();
+  }
+  memset(buf, 'x', sizeof(buf));
+  for(; n > 0; n -= m){
+    m = n < sizeof(buf) ? n : sizeof(buf);
+    if(write(fd, buf, m) != m){
+      printf(2, "cachebench: write %s failed\n", path);
+      exit();
+    }
+  }
+  close(fd);
+}
+
+char*
+small(int i)
+{
+  name[7] = '0' + i / 10;
+  name[8] = '0' + i % 10;
+  return name;
+}
+
+// Touch every small file.
+void
+meta(void)
+{
+  struct stat st;
+  int i, fd;
+
+  for(i = 0; i < NSMALL; i++){
+    if(stat(small(i), &st) < 0 || (fd = open(small(i), O_RDONLY)) < 0){
+      printf(2, "cachebench: cannot open %s\n", small(i));
+      exit();
+    }
+    read(fd, buf, sizeof(buf));
+    close(fd);
+  }
+}
+
+// Read all of the big file.
+void
+scan(void)
+{
+  int fd;
+
+  if((fd = open("cbbig", O_RDONLY)) < 0){
+    printf(2, "cachebench: cannot open cbbig\n");
+    exit();
+  }
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;
+  close(fd);
+}
+
+int
+rate(uint hits, uint misses)
+{
+  if(hits + misses == 0)
+    return 0;
+  return hits * 100 / (hits + misses);
+}
+
+void
+run(char *what, int policy, int nbuf, int rounds)
+{
+  struct bcachestat s0, s1, s2;
+  uint mh, mm;
+  int r;
+
+  // Start from an empty cache.  Blocks written but not
+  // committed stay pinned, so commit them first.
+  if(bcachectl(policy, nbuf) < 0){
+    printf(2, "cachebench: bcachectl failed\n");
+    exit();
+  }
+  sync();
+  bcacheinval();
+  meta();
+  meta();
+  mh = mm = 0;
+  bcachestat(&s0);
+  for(r = 0; r < rounds; r++){
+    scan();
+    bcachestat(&s1);
+    meta();
+    bcachestat(&s2);
+    mh += s2.hits - s1.hits;
+    mm += s2.misses - s1.misses;
+  }
+  printf(1, "%s: %d buffers, metadata hits %d%% (%d/%d), overall %d%%\n",
+         what, s2.nbuf, rate(mh, mm), mh, mh + mm,
+         rate(s2.hits - s0.hits, s2.misses - s0.misses));
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct bcachestat st;
+  int nbuf, rounds, i;
+
+  nbuf = argc > 1 ? atoi(argv[1]) : NBUF;
+  rounds = argc > 2 ? atoi(argv[2]) : 10;
+  if(nbuf < NBUF || rounds <= 0){
+    printf(2, "usage: cachebench [buffers [rounds]]\n");
+    printf(2, "the cache cannot be held below %d buffers\n", NBUF);
+    exit();
+  }
+  bcachestat(&st);
+
+  if(mkdir("cbdir") < 0){
+    printf(2, "cachebench: mkdir cbdir failed\n");
+    exit();
+  }
+  for(i = 0; i < NSMALL; i++)
+    create(small(i), sizeof(buf));
+  create("cbbig", BIGSZ);
+
+  run("lru", BC_LRU, nbuf, rounds);
+  run("2q ", BC_2Q, nbuf, rounds);
+  bcachectl(st.policy, 0);
+
+  for(i = 0; i < NSMALL; i++)
+    unlink(small(i));
+  unlink("cbdir");
+  unlink("cbbig");
+  exit();
+}
@@ -8,6 +8,7 @@
 #include "traps.h"
 #include "spinlock.h"
 #include "fs.h"
+#include "sleeplock.h"
 #include "file.h"
 #include "memlayout.h"
 #include "mmu.h"
@@ -1,18 +1,36 @@
+struct bcachestat;
 struct buf;
 struct context;
 struct file;
 struct inode;
+struct lockclass;
+struct lockstat;
 struct pipe;
 struct proc;
+struct mutex;
+struct procstat;
+struct rwlock;
+struct sleeplock;
 struct spinlock;
 struct stat;
 struct superblock;
+struct timer;
 
 // bio.c
+int             bcachectl(int, int);
+void            bcachestat(struct bcachestat*);
+int             bcacheinval(void);
+void            bdone(struct buf*);
+struct buf*     bgetover(uint, uint);
 void            binit(void);
+void            breadahead(uint, uint);
 struct buf*     bread(uint, uint);
+struct buf*     bread_async(uint, uint);
 void            brelse(struct buf*);
+int             bshrink(int);
+void            bwait(struct buf*);
 void            bwrite(struct buf*);
+void            bwrite_async(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -27,6 +45,7 @@ int             exec(char*, char**);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
+struct file*    fileget(struct file**);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
@@ -34,6 +53,7 @@ int             filewrite(struct file*, char*, int n);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
+int             blocktype(uint, uint);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
@@ -51,10 +71,17 @@ int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
+// futex.c
+void            futexinit(void);
+int             futexwait(uint, uint);
+int             futexwake(uint, int);
+
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idesubmit(struct buf*);
+void            idewaitbuf(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -66,6 +93,7 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kmeminfo(uint*, uint*);
 
 // kbd.c
 void            kbdintr(void);
@@ -73,14 +101,18 @@ void            kbdintr(void);
 // lapic.c
 int             cpunum(void);
 extern volatile uint*    lapic;
+void            lapiccalibrate(void);
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(uchar, int);
 void            lapicstartap(uchar, uint);
+void            lapictimer(uint64);
 void            microdelay(int);
 
 // log.c
 void            initlog(void);
 void            log_write(struct buf*);
+void            log_flush(int);
 void            begin_trans();
 void            commit_trans();
 
@@ -90,6 +122,12 @@ int             mpbcpu(void);
 void            mpinit(void);
 void            mpstartthem(void);
 
+// mutex.c
+int             holdingmutex(struct mutex*);
+void            initmutex(struct mutex*, char*);
+void            mutexlock(struct mutex*);
+void            mutexunlock(struct mutex*);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -102,15 +140,26 @@ int             pipewrite(struct pipe*, char*, int);
 
 //PAGEBREAK: 16
 // proc.c
+void            acctenter(void);
+void            acctleave(void);
 struct proc*    copyproc(struct proc*);
 void            exit(void);
 int             fork(void);
+int             getprocs(struct procstat*, int);
+int             clone(void(*)(void*), void*, void*);
 int             growproc(int);
+void            kproc(char*, void(*)(void));
+int             join(void**);
+void            killthreads(void);
 int             kill(int);
 void            pinit(void);
 void            procdump(void);
+void            resched(void);
+int             rtwait(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+int             setaffinity(int, uint);
+int             setrt(uint, uint);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
@@ -120,11 +169,26 @@ void            yield(void);
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// rwlock.c
+void            acquireread(struct rwlock*);
+void            acquirewrite(struct rwlock*);
+void            initrwlock(struct rwlock*, char*);
+void            releaseread(struct rwlock*);
+void            releasewrite(struct rwlock*);
+
+// sleeplock.c
+void            acquiresleep(struct sleeplock*);
+int             holdingsleep(struct sleeplock*);
+void            initsleeplock(struct sleeplock*, char*);
+void            releasesleep(struct sleeplock*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
+struct lockclass* findlockclass(char*);
 void            initlock(struct spinlock*, char*);
+int             lockstat(struct lockstat*, int);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
@@ -147,6 +211,17 @@ int             fetchstr(uint, char**);
 void            syscall(void);
 
 // timer.c
+void            clockinit(void);
+void            clockintr(void);
+uint64          nsecs(void);
+void            pitwait(int);
+int             sleepuntil(uint64);
+int             sliceover(void);
+uint            tickcount(void);
+void            timeradd(struct timer*, uint64, void(*)(void*), void*);
+void            timerarm(void);
+void            timerdel(struct timer*);
+void            timerslice(uint64);
 void            timerinit(void);
 
 // trap.c
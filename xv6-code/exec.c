@@ -18,6 +18,9 @@ exec(char *path, char **argv)
   struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
 
+  // Only the group leader can replace the address space.
+  if(proc->leader != proc)
+    return -1;
   if((ip = namei(path)) == 0)
     return -1;
   ilock(ip);
@@ -83,6 +86,7 @@ exec(char *path, char **argv)
   safestrcpy(proc->name, last, sizeof(proc->name));
 
   // Commit to the user image.
+  killthreads();
   oldpgdir = proc->pgdir;
   proc->pgdir = pgdir;
   proc->sz = sz;
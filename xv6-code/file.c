@@ -6,8 +6,9 @@
 #include "defs.h"
 #include "param.h"
 #include "fs.h"
-#include "file.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -51,6 +52,26 @@ filedup(struct file *f)
   return f;
 }
 
+// Take a reference to the file in *slot, or return 0 if the
+// slot is empty.  The slot may be in a descriptor table that
+// other threads share; whoever clears it drops the table's
+// reference only afterwards, under ftable.lock, so holding
+// the lock here keeps f alive until ref is incremented.
+struct file*
+fileget(struct file **slot)
+{
+  struct file *f;
+
+  acquire(&ftable.lock);
+  if((f = *slot) != 0){
+    if(f->ref < 1)
+      panic("fileget");
+    f->ref++;
+  }
+  release(&ftable.lock);
+  return f;
+}
+
 // Close file f.  (Decrement ref count, close when reaches 0.)
 void
 fileclose(struct file *f)
@@ -129,7 +150,7 @@ filewrite(struct file *f, char *addr, int n)
     // and 2 blocks of slop for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((LOGSIZE-1-1-2) / 2) * 512;
+    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
@@ -14,7 +14,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
-  int flags;          // I_BUSY, I_VALID
+  struct sleeplock lock; // protects everything below here
+  int flags;          // I_VALID
 
   short type;         // copy of disk inode
   short major;
@@ -22,8 +23,11 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+
+  uint raoff;         // where the last readi ended
+  uint raend;         // first block not read ahead yet
+  uint rawin;         // readahead window, in blocks
 };
-#define I_BUSY 0x1
 #define I_VALID 0x2
 
 // table mapping major device number to
@@ -15,14 +15,21 @@
 #include "stat.h"
 #include "mmu.h"
 #include "proc.h"
+#include "x86.h"
 #include "spinlock.h"
+#include "rwlock.h"
+#include "sleeplock.h"
+#include "mutex.h"
 #include "buf.h"
 #include "fs.h"
 #include "file.h"
+#include "bcachestat.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
 
+static struct superblock rootsb;  // copy kept by readsb for blocktype
+
 // Read the super block.
 void
 readsb(int dev, struct superblock *sb)
@@ -32,6 +39,33 @@ readsb(int dev, struct superblock *sb)
   bp = bread(dev, 1);
   memmove(sb, bp->data, sizeof(*sb));
   brelse(bp);
+  if(dev == ROOTDEV)
+    rootsb = *sb;
+}
+
+// Which part of the file system is blockno on dev in?
+// Used by the buffer cache for statistics, so it must
+// not read the disk; until the root super block has been
+// read, everything but block 1 counts as data.
+int
+blocktype(uint dev, uint blockno)
+{
+  struct superblock *sb;
+  uint bmap;
+
+  sb = &rootsb;
+  if(blockno == 1)
+    return BT_SUPER;
+  if(dev != ROOTDEV || sb->size == 0)
+    return BT_DATA;
+  if(blockno >= sb->size - sb->nlog)
+    return BT_LOG;
+  bmap = BBLOCK(0, sb->ninodes);
+  if(blockno >= IBLOCK(0) && blockno < bmap)
+    return BT_INODE;
+  if(blockno >= bmap && blockno <= bmap + (sb->size - 1) / BPB)
+    return BT_BITMAP;
+  return BT_DATA;
 }
 
 // Zero a block.
@@ -40,7 +74,7 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
   
-  bp = bread(dev, bno);
+  bp = bgetover(dev, bno);
   memset(bp->data, 0, BSIZE);
   log_write(bp);
   brelse(bp);
@@ -134,9 +168,9 @@ bfree(int dev, uint b)
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
-//   has first locked the inode. The I_BUSY flag indicates
-//   that the inode is locked. ilock() sets I_BUSY,
-//   while iunlock clears it.
+//   has first locked the inode. ip->lock is a sleep lock,
+//   so that the holder may wait for the disk; ilock()
+//   acquires it, while iunlock releases it.
 //
 // Thus a typical sequence is:
 //   ip = iget(dev, inum)
@@ -156,15 +190,27 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 
+// icache.lock is a reader-writer lock: iget() looks for a
+// cached inode holding only the read lock, and references
+// other than the last are taken and dropped with atomic
+// instructions and no lock at all.  The write lock is
+// needed to claim a free entry or drop a last reference,
+// so an entry with ip->ref > 0 seen under the read lock
+// cannot be recycled before the reader takes its own.
+
 struct {
-  struct spinlock lock;
+  struct rwlock lock;
   struct inode inode[NINODE];
 } icache;
 
 void
 iinit(void)
 {
-  initlock(&icache.lock, "icache");
+  int i;
+
+  initrwlock(&icache.lock, "icache");
+  for(i = 0; i < NINODE; i++)
+    initsleeplock(&icache.inode[i].lock, "inode");
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -224,14 +270,24 @@ iget(uint dev, uint inum)
 {
   struct inode *ip, *empty;
 
-  acquire(&icache.lock);
-
   // Is the inode already cached?
+  acquireread(&icache.lock);
+  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
+    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+      xadd((uint*)&ip->ref, 1);
+      releaseread(&icache.lock);
+      return ip;
+    }
+  }
+  releaseread(&icache.lock);
+
+  // Look again, now that no one else can add it.
+  acquirewrite(&icache.lock);
   empty = 0;
   for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
     if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&icache.lock);
+      xadd((uint*)&ip->ref, 1);
+      releasewrite(&icache.lock);
       return ip;
     }
     if(empty == 0 && ip->ref == 0)    // Remember empty slot.
@@ -247,7 +303,8 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->flags = 0;
-  release(&icache.lock);
+  ip->raoff = ip->raend = ip->rawin = 0;
+  releasewrite(&icache.lock);
 
   return ip;
 }
@@ -257,9 +314,7 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
-  ip->ref++;
-  release(&icache.lock);
+  xadd((uint*)&ip->ref, 1);
   return ip;
 }
 
@@ -274,11 +329,7 @@ ilock(struct inode *ip)
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
-  acquire(&icache.lock);
-  while(ip->flags & I_BUSY)
-    sleep(ip, &icache.lock);
-  ip->flags |= I_BUSY;
-  release(&icache.lock);
+  acquiresleep(&ip->lock);
 
   if(!(ip->flags & I_VALID)){
     bp = bread(ip->dev, IBLOCK(ip->inum));
@@ -300,13 +351,10 @@ ilock(struct inode *ip)
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !(ip->flags & I_BUSY) || ip->ref < 1)
+  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
-  acquire(&icache.lock);
-  ip->flags &= ~I_BUSY;
-  wakeup(ip);
-  release(&icache.lock);
+  releasesleep(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
@@ -317,22 +365,31 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&icache.lock);
+  int ref;
+
+  // Dropping a reference that is not the last needs no lock.
+  while((ref = ip->ref) > 1)
+    if(cmpxchg((uint*)&ip->ref, ref, ref-1) == ref)
+      return;
+
+  acquirewrite(&icache.lock);
   if(ip->ref == 1 && (ip->flags & I_VALID) && ip->nlink == 0){
     // inode has no links: truncate and free inode.
-    if(ip->flags & I_BUSY)
+    // No one else has a reference, so the lock is free
+    // and acquiresleep() will not sleep.
+    if(ip->lock.locked)
       panic("iput busy");
-    ip->flags |= I_BUSY;
-    release(&icache.lock);
+    acquiresleep(&ip->lock);
+    releasewrite(&icache.lock);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
-    acquire(&icache.lock);
+    acquirewrite(&icache.lock);
     ip->flags = 0;
-    wakeup(ip);
+    releasesleep(&ip->lock);
   }
-  ip->ref--;
-  release(&icache.lock);
+  xadd((uint*)&ip->ref, -1);
+  releasewrite(&icache.lock);
 }
 
 // Common idiom: unlock, then put.
@@ -430,6 +487,40 @@ stati(struct inode *ip, struct stat *st)
 }
 
 //PAGEBREAK!
+// Readahead.  A read that starts where the last one ended
+// is sequential: the window opens at RAMIN blocks and
+// doubles with each sequential read up to RAMAX, and any
+// other read closes it.  Blocks in the window past the
+// ones just read are started without waiting; the window
+// is topped up only when less than half of it is left, so
+// that the disk gets them in batches.  Caller holds ip->lock.
+#define RAMIN   4
+#define RAMAX  32
+
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, end;
+
+  if(off != ip->raoff){
+    ip->raoff = off + n;
+    ip->raend = 0;
+    ip->rawin = 0;
+    return;
+  }
+  ip->raoff = off + n;
+  ip->rawin = ip->rawin == 0 ? RAMIN : min(2*ip->rawin, RAMAX);
+
+  bn = (off + n + BSIZE - 1) / BSIZE;  // first block not read
+  if(ip->raend < bn)
+    ip->raend = bn;
+  if(ip->raend - bn > ip->rawin/2)
+    return;
+  end = min(bn + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+  for(; ip->raend < end; ip->raend++)
+    breadahead(ip->dev, bmap(ip, ip->raend));
+}
+
 // Read data from inode.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
@@ -454,6 +545,8 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
   }
+  if(n > 0)
+    readahead(ip, off - n, n);
   return n;
 }
 
@@ -477,8 +570,11 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(m == BSIZE)  // whole block: no need to read it first
+      bp = bgetover(ip->dev, bmap(ip, off/BSIZE));
+    else
+      bp = bread(ip->dev, bmap(ip, off/BSIZE));
     memmove(bp->data + off%BSIZE, src, m);
     log_write(bp);
     brelse(bp);
@@ -609,7 +705,7 @@ namex(char *path, int nameiparent, char *name)
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
   else
-    ip = idup(proc->cwd);
+    ip = idup(proc->leader->cwd);
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
@@ -9,7 +9,13 @@
 // Then sb.nlog log blocks.
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+
+// Block size.  May be set to any power of two from SECTSIZE
+// up to the page size (PGSIZE); mkfs and the kernel must agree.
+// Each block is read or written as one multi-sector request.
+#define BSIZE 4096
+#define SECTSIZE 512  // disk sector size
+#define SPB (BSIZE / SECTSIZE)  // sectors per block
 
 // File system super block
 struct superblock {
@@ -0,0 +1,115 @@
+// Futexes: user-space locks that enter the kernel only to
+// wait when contended, and to wake waiters on release.
+//
+// A futex is a word of user memory, identified by its
+// physical address so that the same word reached through
+// different mappings is the same futex.  Waiters queue in
+// FIFO order on a hash chain keyed by that address.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NFUTEXHASH 61
+
+// One per waiting process, on its kernel stack.
+struct futexwaiter {
+  uint key;                   // Physical address of the futex word
+  int woken;                  // Set by futexwake
+  struct futexwaiter *next;   // Hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct futexwaiter *hash[NFUTEXHASH];
+} futex;
+
+void
+futexinit(void)
+{
+  initlock(&futex.lock, "futex");
+}
+
+// Return the kernel address of the user word at uaddr,
+// which the caller has checked to be in the process.
+static uint*
+futexword(uint uaddr)
+{
+  char *page;
+
+  if(uaddr % 4)
+    return 0;
+  if((page = uva2ka(proc->pgdir, (char*)PGROUNDDOWN(uaddr))) == 0)
+    return 0;
+  return (uint*)(page + (uaddr % PGSIZE));
+}
+
+// If the word at uaddr still holds val, sleep until futexwake.
+// Return 0 when woken, -1 if the word changed or on error,
+// or if killed while waiting.
+int
+futexwait(uint uaddr, uint val)
+{
+  struct futexwaiter w, **pp;
+  uint *word;
+
+  if((word = futexword(uaddr)) == 0)
+    return -1;
+  w.key = v2p(word);
+  w.woken = 0;
+  w.next = 0;
+
+  // Checking the word and queueing under futex.lock means
+  // that a futexwake after the user changed it finds us.
+  acquire(&futex.lock);
+  if(*word != val){
+    release(&futex.lock);
+    return -1;
+  }
+  for(pp = &futex.hash[w.key % NFUTEXHASH]; *pp; pp = &(*pp)->next)
+    ;
+  *pp = &w;
+  while(!w.woken && !proc->killed)
+    sleep(&w, &futex.lock);
+  if(!w.woken){
+    for(pp = &futex.hash[w.key % NFUTEXHASH]; *pp != &w; pp = &(*pp)->next)
+      ;
+    *pp = w.next;
+  }
+  release(&futex.lock);
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n processes waiting on the futex at uaddr,
+// oldest first.  Return the number woken.
+int
+futexwake(uint uaddr, int n)
+{
+  struct futexwaiter *w, **pp;
+  uint *word, key;
+  int woken;
+
+  if((word = futexword(uaddr)) == 0)
+    return -1;
+  key = v2p(word);
+
+  woken = 0;
+  acquire(&futex.lock);
+  pp = &futex.hash[key % NFUTEXHASH];
+  while((w = *pp) != 0 && woken < n){
+    if(w->key != key){
+      pp = &w->next;
+      continue;
+    }
+    *pp = w->next;
+    w->woken = 1;
+    wakeup(w);
+    woken++;
+  }
+  release(&futex.lock);
+  return woken;
+}
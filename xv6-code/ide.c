@@ -9,6 +9,8 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "mutex.h"
+#include "fs.h"
 #include "buf.h"
 
 #define IDE_BSY       0x80
@@ -18,6 +20,9 @@
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
+#define IDE_CMD_RDMUL 0xc4
+#define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
@@ -42,6 +47,18 @@ idewait(int checkerr)
   return 0;
 }
 
+// Set the number of sectors disk dev moves per interrupt
+// for the multiple-sector commands to SPB.
+static void
+idesetmul(int dev)
+{
+  outb(0x3f6, 2);  // no interrupt
+  outb(0x1f6, 0xe0 | ((dev&1)<<4));
+  outb(0x1f2, SPB);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  idewait(0);
+}
+
 void
 ideinit(void)
 {
@@ -61,6 +78,14 @@ ideinit(void)
     }
   }
   
+  // Transfer a whole block per interrupt when reading
+  // or writing several sectors at once.
+  if(SPB > 1){
+    idesetmul(0);
+    if(havedisk1)
+      idesetmul(1);
+  }
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
@@ -69,21 +94,24 @@ ideinit(void)
 static void
 idestart(struct buf *b)
 {
+  uint sector;
+
   if(b == 0)
     panic("idestart");
+  sector = b->blockno * SPB;
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, 1);  // number of sectors
-  outb(0x1f3, b->sector & 0xff);
-  outb(0x1f4, (b->sector >> 8) & 0xff);
-  outb(0x1f5, (b->sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((b->sector>>24)&0x0f));
+  outb(0x1f2, SPB);  // number of sectors
+  outb(0x1f3, sector & 0xff);
+  outb(0x1f4, (sector >> 8) & 0xff);
+  outb(0x1f5, (sector >> 16) & 0xff);
+  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
-    outb(0x1f7, IDE_CMD_WRITE);
-    outsl(0x1f0, b->data, 512/4);
+    outb(0x1f7, SPB == 1 ? IDE_CMD_WRITE : IDE_CMD_WRMUL);
+    outsl(0x1f0, b->data, BSIZE/4);
   } else {
-    outb(0x1f7, IDE_CMD_READ);
+    outb(0x1f7, SPB == 1 ? IDE_CMD_READ : IDE_CMD_RDMUL);
   }
 }
 
@@ -104,12 +132,16 @@ ideintr(void)
 
   // Read data if needed.
   if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, 512/4);
+    insl(0x1f0, b->data, BSIZE/4);
   
   // Wake process waiting for this buf.
   b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
+  b->flags &= ~(B_DIRTY|B_IO);
   wakeup(b);
+  if(b->flags & B_ASYNC){
+    b->flags &= ~B_ASYNC;
+    bdone(b);
+  }
   
   // Start disk on next buf in queue.
   if(idequeue != 0)
@@ -119,23 +151,16 @@ ideintr(void)
 }
 
 //PAGEBREAK!
-// Sync buf with disk. 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// Append b to idequeue and start the disk if it is idle.
+// Caller must hold idelock.
+static void
+idequeueb(struct buf *b)
 {
   struct buf **pp;
 
-  if(!(b->flags & B_BUSY))
-    panic("iderw: buf not busy");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  acquire(&idelock);  //DOC:acquire-lock
-
   // Append b to idequeue.
   b->qnext = 0;
   for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
@@ -145,11 +170,50 @@ iderw(struct buf *b)
   // Start disk if necessary.
   if(idequeue == b)
     idestart(b);
-  
-  // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+}
+
+// Queue b for the disk: a write if B_DIRTY is set, else a
+// read.  Does not wait; see idewaitbuf.  The caller sets
+// B_IO, which ideintr() clears when the request is done.
+// The caller holds b's lock, or for a readahead (B_ASYNC)
+// just a reference, which ideintr() drops with bdone().
+void
+idesubmit(struct buf *b)
+{
+  if(!(b->flags & B_IO))
+    panic("idesubmit");
+  if(!(b->flags & B_ASYNC) && !holdingmutex(&b->lock))
+    panic("iderw: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("iderw: nothing to do");
+
+  acquire(&idelock);  //DOC:acquire-lock
+  idequeueb(b);
+  release(&idelock);
+}
+
+// Wait for the request for b to finish.
+void
+idewaitbuf(struct buf *b)
+{
+  acquire(&idelock);
+  while(b->flags & B_IO){
     sleep(b, &idelock);
   }
-
   release(&idelock);
 }
+
+// Sync buf with disk. 
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If a read of b was started already (by readahead),
+// just wait for it.
+void
+iderw(struct buf *b)
+{
+  if(!(b->flags & B_IO)){
+    b->flags |= B_IO;
+    idesubmit(b);
+  }
+  idewaitbuf(b);
+}
@@ -1,6 +1,6 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// pipe buffers and the buffer cache. Allocates 4096-byte pages.
 
 #include "types.h"
 #include "defs.h"
@@ -9,6 +9,8 @@
 #include "mmu.h"
 #include "spinlock.h"
 
+#define KSHRINK 8  // pages to take back from the buffer cache at once
+
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
 
@@ -20,6 +22,8 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  uint npages;  // pages given to the allocator
+  uint nfree;   // pages on freelist
 } kmem;
 
 // Initialization happens in two phases.
@@ -47,8 +51,10 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.npages++;
     kfree(p);
+  }
 }
 
 //PAGEBREAK: 21
@@ -72,6 +78,7 @@ kfree(char *v)
   r = (struct run*)v;
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
   if(kmem.use_lock)
     release(&kmem.lock);
 }
@@ -79,18 +86,33 @@ kfree(char *v)
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When memory runs out, takes pages back from the
+// buffer cache before giving up.
 char*
 kalloc(void)
 {
   struct run *r;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
-  return (char*)r;
+  for(;;){
+    if(kmem.use_lock)
+      acquire(&kmem.lock);
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      kmem.nfree--;
+    }
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    if(r || !kmem.use_lock || bshrink(KSHRINK) == 0)
+      return (char*)r;
+  }
+}
+
+// Report how many pages there are in all and how many are free.
+void
+kmeminfo(uint *total, uint *free)
+{
+  *total = kmem.npages;
+  *free = kmem.nfree;
 }
 
@@ -3,6 +3,7 @@
 
 #include "types.h"
 #include "defs.h"
+#include "param.h"
 #include "memlayout.h"
 #include "traps.h"
 #include "mmu.h"
@@ -30,6 +31,7 @@
 #define TIMER   (0x0320/4)   // Local Vector Table 0 (TIMER)
   #define X1         0x0000000B   // divide counts by 1
   #define PERIODIC   0x00020000   // Periodic
+  #define ONESHOT    0x00000000   // One-shot
 #define PCINT   (0x0340/4)   // Performance Counter LVT
 #define LINT0   (0x0350/4)   // Local Vector Table 1 (LINT0)
 #define LINT1   (0x0360/4)   // Local Vector Table 2 (LINT1)
@@ -40,6 +42,7 @@
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
 volatile uint *lapic;  // Initialized in mp.c
+static uint lapickhz;  // Timer counts per millisecond
 
 static void
 lapicw(int index, int value)
@@ -58,13 +61,12 @@ lapicinit(void)
   // Enable local APIC; set spurious interrupt vector.
   lapicw(SVR, ENABLE | (T_IRQ0 + IRQ_SPURIOUS));
 
-  // The timer repeatedly counts down at bus frequency
-  // from lapic[TICR] and then issues an interrupt.  
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
+  // The timer counts down once at bus frequency from
+  // lapic[TICR] and then issues an interrupt.  It stays
+  // stopped until lapictimer() arms it; see timer.c.
   lapicw(TDCR, X1);
-  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000); 
+  lapicw(TIMER, ONESHOT | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, 0);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -123,6 +125,40 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Calibrate the timer against the PIT: let it count down
+// from its maximum, masked, while pitwait() busy-waits.
+void
+lapiccalibrate(void)
+{
+  lapicw(TIMER, MASKED);
+  lapicw(TICR, 0xffffffff);
+  pitwait(CALMS);
+  lapickhz = (0xffffffff - lapic[TCCR]) / CALMS;
+  lapicw(TICR, 0);
+  lapicw(TIMER, ONESHOT | (T_IRQ0 + IRQ_TIMER));
+}
+
+// Arm this CPU's timer to interrupt once, ns nanoseconds
+// from now.  Zero stops the timer.  Waits longer than a
+// second are cut short so the count fits in TICR; the
+// interrupt handler simply arms the timer again.
+void
+lapictimer(uint64 ns)
+{
+  uint count;
+
+  if(!lapic)
+    return;
+  if(ns == 0){
+    lapicw(TICR, 0);
+    return;
+  }
+  if(ns > NSPERSEC)
+    ns = NSPERSEC;
+  count = divl(ns * lapickhz + 999999, 1000000);
+  lapicw(TICR, count ? count : 1);
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
@@ -132,6 +168,21 @@ microdelay(int us)
 
 #define IO_RTC  0x70
 
+// Send an inter-processor interrupt with the given vector
+// to the processor whose local APIC id is apicid.
+// Must be called with interrupts off, since the ICR
+// is written in two steps.
+void
+lapicipi(uchar apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Start additional processor running entry code at addr.
 // See Appendix B of MultiProcessor Specification.
 void
@@ -0,0 +1,66 @@
+// Spinlock contention benchmark.  Runs 2, 4 and 8 processes,
+// each pinned to its own CPU, that call kill() on a pid that
+// cannot exist as fast as they can: that takes ptable.lock
+// for a moment and does little else.  Prints the total rate
+// and each process's count; with a fair lock the counts
+// come out about equal.
+// usage: lockbench [ms]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define MAXW 8
+
+int
+killmany(void)
+{
+  int i;
+
+  for(i = 0; i < 64; i++)
+    kill(-1);
+  return 64;
+}
+
+void
+run(int nw, int ms)
+{
+  uint n[MAXW], total, min, max;
+  int i;
+
+  total = benchrun(nw, ms, killmany, n);
+  max = 0;
+  min = ~0;
+  for(i = 0; i < nw; i++){
+    if(n[i] < min)
+      min = n[i];
+    if(n[i] > max)
+      max = n[i];
+  }
+  printf(1, "%d cpus: %d acquires/ms, min/max %d%%:",
+         nw, total / ms, max >= 100 ? min / (max / 100) : 100);
+  for(i = 0; i < nw; i++)
+    printf(1, " %d", n[i]);
+  printf(1, "\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ms, ncpu, nw;
+
+  ms = argc > 1 ? atoi(argv[1]) : 1000;
+  if(ms <= 0){
+    printf(2, "usage: lockbench [ms]\n");
+    exit();
+  }
+  ncpu = ncpus();
+  for(nw = 2; nw <= MAXW; nw *= 2){
+    if(nw > ncpu){
+      printf(1, "%d cpus: only %d available\n", nw, ncpu);
+      continue;
+    }
+    run(nw, ms);
+  }
+  exit();
+}
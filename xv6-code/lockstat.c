@@ -0,0 +1,99 @@
+// Show spinlock and mutex statistics, most contended first.
+// With a command, run it and show only what happened
+// while it ran (the maximum hold time is since boot).
+// usage: lockstat [command [args...]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "lockstat.h"
+
+struct lockstat before[NLOCKNAME], after[NLOCKNAME];
+int order[NLOCKNAME];
+
+// Print n right-justified in a field w wide.
+void
+putnum(uint n, int w)
+{
+  char buf[12];
+  int i;
+
+  i = sizeof(buf) - 1;
+  buf[i] = 0;
+  do {
+    buf[--i] = '0' + n % 10;
+    n /= 10;
+  } while(n > 0 && i > 0);
+  while(w-- > sizeof(buf) - 1 - i)
+    printf(1, " ");
+  printf(1, "%s ", buf + i);
+}
+
+// Does a come before b?  More contended first,
+// then more time spent waiting.
+int
+ahead(struct lockstat *a, struct lockstat *b)
+{
+  if(a->contended != b->contended)
+    return a->contended > b->contended;
+  return a->spin > b->spin;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, nb, i, j, k, pid;
+  struct lockstat *l;
+
+  nb = 0;
+  if(argc > 1){
+    nb = lockstat(before, NLOCKNAME);
+    if((pid = fork()) < 0){
+      printf(2, "lockstat: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      exec(argv[1], argv+1);
+      printf(2, "lockstat: exec %s failed\n", argv[1]);
+      exit();
+    }
+    wait();
+  }
+  n = lockstat(after, NLOCKNAME);
+
+  // Entries only ever get added, at the end.
+  for(i = 0; i < n; i++){
+    l = &after[i];
+    if(i < nb){
+      l->acquires -= before[i].acquires;
+      l->contended -= before[i].contended;
+      l->spin -= before[i].spin;
+      l->sleeps -= before[i].sleeps;
+      l->handoffs -= before[i].handoffs;
+    }
+    for(j = i; j > 0 && ahead(l, &after[order[j-1]]); j--)
+      order[j] = order[j-1];
+    order[j] = i;
+  }
+
+  printf(1, "NAME              LOCKS   ACQUIRES  CONTENDED %%CONT  SPIN(Kcyc) MAXHOLD(cyc)  SLEEPS HANDOFFS\n");
+  for(k = 0; k < n; k++){
+    l = &after[order[k]];
+    if(l->acquires == 0)
+      continue;
+    printf(1, "%s", l->name);
+    for(j = strlen(l->name); j < 16; j++)
+      printf(1, " ");
+    putnum(l->ninit, 7);
+    putnum(l->acquires, 10);
+    putnum(l->contended, 10);
+    putnum(l->acquires >= 100 ? l->contended / (l->acquires / 100) : 0, 5);
+    putnum(l->spin >> 42 ? ~0 : (uint)(l->spin >> 10), 11);
+    putnum(l->maxhold >> 32 ? ~0 : (uint)l->maxhold, 12);
+    putnum(l->sleeps, 7);
+    putnum(l->handoffs, 8);
+    printf(1, "\n");
+  }
+  exit();
+}
@@ -0,0 +1,15 @@
+// Spinlock statistics, as returned by lockstat().
+// Locks initialized with the same name are counted
+// together.  Times are in TSC cycles.
+#define LOCKNAMESZ 16
+
+struct lockstat {
+  char name[LOCKNAMESZ];
+  uint ninit;        // Locks initialized with this name
+  uint acquires;     // Times acquired
+  uint contended;    // Acquires that had to wait
+  uint64 spin;       // Time spent waiting
+  uint64 maxhold;    // Longest time held
+  uint sleeps;       // Mutexes: waits that blocked
+  uint handoffs;     // Mutexes: releases that woke a waiter
+};
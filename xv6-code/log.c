@@ -1,41 +1,54 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 #include "fs.h"
+#include "mutex.h"
 #include "buf.h"
 
 // Simple logging. Each system call that might write the file system
 // should be surrounded with begin_trans() and commit_trans() calls.
 //
-// The log holds at most one transaction at a time. Commit forces
-// the log (with commit record) to disk, then installs the affected
-// blocks to disk, then erases the log. begin_trans() ensures that
-// only one system call can be in a transaction; others must wait.
-// 
-// Allowing only one transaction at a time means that the file
+// Only one system call can be in a transaction at a time;
+// begin_trans() makes others wait.  This means that the file
 // system code doesn't have to worry about the possibility of
 // one transaction reading a block that another one has modified,
 // for example an i-node block.
 //
+// The log is written back lazily.  A transaction's blocks stay
+// in the buffer cache, pinned by B_DIRTY, and later transactions
+// are added to the same log, until one of these happens:
+// * the log has no room left for another transaction
+//     (each writes at most MAXOPBLOCKS blocks),
+// * the oldest uncommitted transaction is WBDELAY ms old,
+//     which the flusher process checks,
+// * sync() or fsync() is called.
+// Then commit writes the blocks to the log, forces the log
+// header (the commit record) to disk, installs the blocks at
+// their home locations in block order, and erases the log.
+// A crash loses the uncommitted transactions, but each is
+// lost or kept whole.  If WBDELAY is 0, every transaction
+// commits at once.
+//
 // Read-only system calls don't need to use transactions, though
 // this means that they may observe uncommitted data. I-node and
 // buffer locks prevent read-only calls from seeing inconsistent data.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing sector #s for block A, B, C, ...
+//   header block, containing block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
 
 // Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged sector #s before commit.
+// and to keep track in memory of logged block #s before commit.
 struct logheader {
   int n;   
-  int sector[LOGSIZE];
+  int block[LOGSIZE];
 };
 
 struct log {
@@ -44,11 +57,13 @@ struct log {
   int size;
   int busy; // a transaction is active
   int dev;
+  uint64 since; // when the oldest uncommitted transaction ended
   struct logheader lh;
 };
 struct log log;
 
 static void recover_from_log(void);
+static void flusher(void);
 
 void
 initlog(void)
@@ -63,21 +78,61 @@ initlog(void)
   log.size = sb.nlog;
   log.dev = ROOTDEV;
   recover_from_log();
+  if(WBDELAY > 0)
+    kproc("flusher", flusher);
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// in block order.  Start all the log reads first, and wait
+// for the writes only at the end, so that the disk always
+// has work queued.
 static void 
 install_trans(void)
 {
+  struct buf *lbuf[LOGSIZE], *dbuf[LOGSIZE];
+  int order[LOGSIZE];
+  int i, j, tail;
+
+  for (i = 0; i < log.lh.n; i++) {
+    for (j = i; j > 0 && log.lh.block[order[j-1]] > log.lh.block[i]; j--)
+      order[j] = order[j-1];
+    order[j] = i;
+  }
+
+  for (i = 0; i < log.lh.n; i++)
+    lbuf[i] = bread_async(log.dev, log.start+order[i]+1); // read log block
+  for (i = 0; i < log.lh.n; i++) {
+    tail = order[i];
+    dbuf[i] = bgetover(log.dev, log.lh.block[tail]); // dst
+    bwait(lbuf[i]);
+    memmove(dbuf[i]->data, lbuf[i]->data, BSIZE);  // copy block to dst
+    bwrite_async(dbuf[i]);  // write dst to disk
+    brelse(lbuf[i]);
+  }
+  for (i = 0; i < log.lh.n; i++) {
+    bwait(dbuf[i]);
+    brelse(dbuf[i]);
+  }
+}
+
+// Copy the logged blocks from the cache to the log.
+static void
+write_log(void)
+{
+  struct buf *to[LOGSIZE];
+  struct buf *from;
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.sector[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf); 
-    brelse(dbuf);
+    to[tail] = bgetover(log.dev, log.start+tail+1); // log block
+    from = bread(log.dev, log.lh.block[tail]); // cache block
+    memmove(to[tail]->data, from->data, BSIZE);
+    brelse(from);
+    bwrite_async(to[tail]);
+  }
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(to[tail]);
+    brelse(to[tail]);
   }
 }
 
@@ -90,7 +145,7 @@ read_head(void)
   int i;
   log.lh.n = lh->n;
   for (i = 0; i < log.lh.n; i++) {
-    log.lh.sector[i] = lh->sector[i];
+    log.lh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -106,7 +161,7 @@ write_head(void)
   int i;
   hb->n = log.lh.n;
   for (i = 0; i < log.lh.n; i++) {
-    hb->sector[i] = log.lh.sector[i];
+    hb->block[i] = log.lh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -121,6 +176,29 @@ recover_from_log(void)
   write_head(); // clear the log
 }
 
+// Commit the logged transactions.  Caller must be in a
+// transaction, or otherwise have set log.busy.
+static void
+commit(void)
+{
+  if (log.lh.n > 0) {
+    write_log();     // Write modified blocks from cache to log
+    write_head();    // Write header to disk -- the real commit
+    install_trans(); // Now install writes to home locations
+    log.lh.n = 0; 
+    write_head();    // Erase the transaction from the log
+  }
+  log.since = 0;
+}
+
+// Room in the log: less than a full log, since the header
+// takes a block, and at most LOGSIZE.
+static int
+logroom(void)
+{
+  return log.size - 1 < LOGSIZE ? log.size - 1 : LOGSIZE;
+}
+
 void
 begin_trans(void)
 {
@@ -130,17 +208,19 @@ begin_trans(void)
   }
   log.busy = 1;
   release(&log.lock);
+
+  // Make sure this transaction will fit.
+  if (log.lh.n + MAXOPBLOCKS > logroom())
+    commit();
 }
 
 void
 commit_trans(void)
 {
-  if (log.lh.n > 0) {
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0; 
-    write_head();    // Erase the transaction from the log
-  }
+  if (WBDELAY == 0)
+    commit();
+  else if (log.lh.n > 0 && log.since == 0)
+    log.since = nsecs();
   
   acquire(&log.lock);
   log.busy = 0;
@@ -148,9 +228,34 @@ commit_trans(void)
   release(&log.lock);
 }
 
+// Commit the log if it holds anything, or with all == 0,
+// only if the oldest transaction in it is WBDELAY old.
+// For sync() and fsync(), and the flusher.
+void
+log_flush(int all)
+{
+  if (!all && (log.since == 0 || nsecs() - log.since < WBDELAY*1000000ULL))
+    return;
+  begin_trans();
+  if (all || log.since)
+    commit();
+  commit_trans();
+}
+
+// The flusher process: commit transactions as they age.
+static void
+flusher(void)
+{
+  for (;;) {
+    if (sleepuntil(nsecs() + WBDELAY*1000000ULL/2) < 0)
+      proc->killed = 0;  // kernel processes do not exit
+    log_flush(0);
+  }
+}
+
 // Caller has modified b->data and is done with the buffer.
-// Append the block to the log and record the block number, 
-// but don't write the log header (which would commit the write).
+// Record the block number in the log and pin the block in the
+// cache; commit copies it to the log.
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
 //   modify bp->data[]
@@ -161,20 +266,16 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= logroom())
     panic("too big a transaction");
   if (!log.busy)
     panic("write outside of trans");
 
   for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.sector[i] == b->sector)   // log absorbtion?
+    if (log.lh.block[i] == b->blockno)   // log absorbtion?
       break;
   }
-  log.lh.sector[i] = b->sector;
-  struct buf *lbuf = bread(b->dev, log.start+i+1);
-  memmove(lbuf->data, b->data, BSIZE);
-  bwrite(lbuf);
-  brelse(lbuf);
+  log.lh.block[i] = b->blockno;
   if (i == log.lh.n)
     log.lh.n++;
   b->flags |= B_DIRTY; // XXX prevent eviction
@@ -9,18 +9,22 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "mutex.h"
+#include "fs.h"
 #include "buf.h"
 
 extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
 
 static int disksize;
 static uchar *memdisk;
+static struct spinlock memidelock;
 
 void
 ideinit(void)
 {
+  initlock(&memidelock, "memide");
   memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/512;
+  disksize = (uint)_binary_fs_img_size/BSIZE;
 }
 
 // Interrupt handler.
@@ -30,29 +34,72 @@ ideintr(void)
   // no-op
 }
 
-// Sync buf with disk. 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// Copy b to or from the disk, if that is still to be done.
+// Caller must hold memidelock.
+static void
+memiderw(struct buf *b)
 {
   uchar *p;
 
-  if(!(b->flags & B_BUSY))
-    panic("iderw: buf not busy");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
+  if(!(b->flags & B_IO))
+    return;
   if(b->dev != 1)
     panic("iderw: request not for disk 1");
-  if(b->sector >= disksize)
-    panic("iderw: sector out of range");
+  if(b->blockno >= disksize)
+    panic("iderw: block out of range");
 
-  p = memdisk + b->sector*512;
+  p = memdisk + b->blockno*BSIZE;
   
   if(b->flags & B_DIRTY){
     b->flags &= ~B_DIRTY;
-    memmove(p, b->data, 512);
+    memmove(p, b->data, BSIZE);
   } else
-    memmove(b->data, p, 512);
+    memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
+  b->flags &= ~B_IO;
+}
+
+// The memory disk has no queue, so requests are done at once.
+// A readahead's may have been done by idewaitbuf() already.
+void
+idesubmit(struct buf *b)
+{
+  int ahead;
+
+  if(!(b->flags & B_IO))
+    panic("idesubmit");
+  ahead = (b->flags & B_ASYNC) && !holdingmutex(&b->lock);
+  if(!ahead && !holdingmutex(&b->lock))
+    panic("iderw: buf not locked");
+
+  acquire(&memidelock);
+  memiderw(b);
+  if(ahead)
+    b->flags &= ~B_ASYNC;
+  release(&memidelock);
+  if(ahead)
+    bdone(b);
+}
+
+void
+idewaitbuf(struct buf *b)
+{
+  acquire(&memidelock);
+  memiderw(b);
+  release(&memidelock);
+}
+
+// Sync buf with disk. 
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("iderw: nothing to do");
+  if(!(b->flags & B_IO)){
+    b->flags |= B_IO;
+    idesubmit(b);
+  }
+  idewaitbuf(b);
 }
@@ -0,0 +1,143 @@
+// Adaptive mutexes.
+//
+// An uncontended mutexlock() is a single cmpxchg.  When the
+// mutex is held, the caller spins for up to MUTEXSPIN cycles
+// as long as the owner is running on some CPU, and sleeps as
+// soon as the owner is not running, or once it has spun that
+// long.  mutexunlock() takes the spinlock and calls wakeup()
+// only if somebody is sleeping.
+//
+// Statistics are kept with the spinlocks' (see lockstat):
+// acquires, contended acquires, cycles spent spinning and
+// sleeping, maximum hold time, how many acquires had to
+// sleep and how many releases handed the mutex to a sleeper.
+// Many sleeps with short holds say MUTEXSPIN is too small.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "mutex.h"
+
+#define MUTEXSPIN 20000  // Cycles to spin before sleeping
+
+void
+initmutex(struct mutex *m, char *name)
+{
+  initlock(&m->lk, "mutex");
+  m->locked = 0;
+  m->owner = 0;
+  m->nwait = 0;
+  m->name = name;
+  m->class = findlockclass(name);
+}
+
+// Spin while the owner is running elsewhere.
+// Returns 1 if the mutex was acquired.
+static int
+mutexspin(struct mutex *m, uint64 t0)
+{
+  struct proc *p;
+
+  while(rdtsc() - t0 < MUTEXSPIN){
+    p = m->owner;
+    if(p && p->state != RUNNING)
+      return 0;
+    if(m->locked == 0 && cmpxchg(&m->locked, 0, 1) == 0)
+      return 1;
+    pause();
+  }
+  return 0;
+}
+
+// Acquire the mutex, spinning or sleeping until it is free.
+// Must not be called holding a spinlock.
+void
+mutexlock(struct mutex *m)
+{
+  uint64 t0;
+  int slept;
+  struct lockcpu *s;
+
+  if(holdingmutex(m))
+    panic("mutexlock");
+
+  t0 = 0;
+  slept = 0;
+  if(cmpxchg(&m->locked, 0, 1) != 0){
+    t0 = rdtsc();
+    if(!mutexspin(m, t0)){
+      acquire(&m->lk);
+      m->nwait++;
+      while(xchg(&m->locked, 1) != 0){
+        slept = 1;
+        sleep(m, &m->lk);
+      }
+      m->nwait--;
+      release(&m->lk);
+    }
+  }
+  m->owner = proc;
+  m->tacquire = rdtsc();
+
+  if(m->class){
+    pushcli();
+    s = &m->class->cpu[cpu - cpus];
+    s->acquires++;
+    if(t0){
+      s->contended++;
+      s->spin += m->tacquire - t0;
+    }
+    s->sleeps += slept;
+    popcli();
+  }
+}
+
+// Release the mutex, waking a sleeper if there is one.
+void
+mutexunlock(struct mutex *m)
+{
+  uint64 hold;
+  int woke;
+  struct lockcpu *s;
+
+  if(!holdingmutex(m))
+    panic("mutexunlock");
+
+  hold = rdtsc() - m->tacquire;
+  m->owner = 0;
+  xchg(&m->locked, 0);
+
+  // A sleeper increments nwait before it tries the mutex
+  // for the last time, and the xchg above orders the read
+  // of nwait after the release, so none can be missed.
+  woke = 0;
+  if(m->nwait){
+    acquire(&m->lk);
+    if(m->nwait){
+      wakeup(m);
+      woke = 1;
+    }
+    release(&m->lk);
+  }
+
+  if(m->class){
+    pushcli();
+    s = &m->class->cpu[cpu - cpus];
+    if(hold > s->maxhold)
+      s->maxhold = hold;
+    s->handoffs += woke;
+    popcli();
+  }
+}
+
+// Does the current process hold the mutex?
+int
+holdingmutex(struct mutex *m)
+{
+  return m->locked && m->owner == proc;
+}
@@ -0,0 +1,15 @@
+// Adaptive mutex: a process that finds it held spins for a
+// while if the holder is running on another CPU, since then
+// it is likely to be released soon, and sleeps otherwise.
+// Like a sleep lock, it may be held across sleeps.
+struct mutex {
+  volatile uint locked;   // Is the mutex held?
+  struct proc *owner;     // Process holding it
+  volatile uint nwait;    // Processes sleeping for it
+  struct spinlock lk;     // Protects sleeping and waking
+
+  // For lockstat:
+  char *name;               // Name of mutex
+  struct lockclass *class;  // Statistics for mutexes of this name
+  uint64 tacquire;          // TSC when acquired
+};
@@ -1,12 +1,19 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC      4096  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NBUF         10  // size of disk block cache
+#define NBUF (LOGSIZE*3)  // minimum size of disk block cache
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define LOGSIZE      10  // max data sectors in on-disk log
+#define MAXOPBLOCKS  10  // max blocks any FS op writes
+#define LOGSIZE (MAXOPBLOCKS*3)  // max data blocks in on-disk log
+#define WBDELAY    2000  // ms before the log is committed; 0 to write through
+#define HZ          100  // clock ticks per second
+#define NSPERSEC 1000000000  // nanoseconds per second
+#define NSPERTICK (NSPERSEC/HZ)  // nanoseconds per clock tick
+#define CALMS        10  // clock calibration interval, in ms
+#define NLOCKNAME    64  // lock names counted by lockstat
 
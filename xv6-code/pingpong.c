@@ -0,0 +1,93 @@
+// Measure the cost of a context switch by passing a byte
+// back and forth through a pair of pipes: every round trip
+// is two switches.  Runs the two sides as processes on one
+// CPU, as threads (sharing an address space) on one CPU,
+// and as processes free to run anywhere.
+// usage: pingpong [rounds]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+int rounds = 10000;
+int ping[2], pong[2];
+
+// Echo every byte from ping back on pong.
+void
+echo(void *arg)
+{
+  char c;
+  int i;
+
+  for(i = 0; i < rounds; i++){
+    if(read(ping[0], &c, 1) != 1 || write(pong[1], &c, 1) != 1){
+      printf(2, "pingpong: echo failed\n");
+      break;
+    }
+  }
+}
+
+// Time rounds round trips against an echo thread or
+// process restricted to the CPUs in mask, and print
+// the cost of one switch.
+void
+run(char *what, int threads, uint mask)
+{
+  uint64 t0;
+  uint us, old;
+  char c;
+  int i, pid;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf(2, "pingpong: pipe failed\n");
+    exit();
+  }
+  old = setaffinity(0, mask);
+  if(threads)
+    pid = thread_create(echo, 0);
+  else if((pid = fork()) == 0){
+    echo(0);
+    exit();
+  }
+  if(pid < 0){
+    printf(2, "pingpong: cannot start echo\n");
+    exit();
+  }
+
+  c = 'x';
+  t0 = usecs();
+  for(i = 0; i < rounds; i++){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      printf(2, "pingpong: ping failed\n");
+      break;
+    }
+  }
+  us = usecs() - t0;
+
+  if(threads)
+    thread_join();
+  else
+    wait();
+  setaffinity(0, old);
+  close(ping[0]);
+  close(ping[1]);
+  close(pong[0]);
+  close(pong[1]);
+  printf(1, "%s: %d round trips in %d us, %d ns per switch\n",
+         what, rounds, us, us / rounds * 500 + us % rounds * 500 / rounds);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds <= 0){
+    printf(2, "usage: pingpong [rounds]\n");
+    exit();
+  }
+  run("processes, one cpu", 0, 1);
+  run("threads, one cpu", 1, 1);
+  run("processes, any cpu", 0, ~0);
+  exit();
+}
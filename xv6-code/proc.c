@@ -5,13 +5,29 @@
 #include "mmu.h"
 #include "x86.h"
 #include "proc.h"
+#include "traps.h"
 #include "spinlock.h"
+#include "procstat.h"
+
+// Processes are allocated from kalloc'd pages as needed, up
+// to NPROC at a time; an exited one goes on a free list for
+// reuse.  Live processes are found by pid through a hash
+// table, and sleeping ones by chan through another, so that
+// no operation has to look at every process.
+#define NPIDHASH   257
+#define NSLEEPHASH 257
 
 struct {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  int nproc;                          // Processes allocated
+  struct proc *free;                  // Unused procs, linked by pidnext
+  struct proc *pidhash[NPIDHASH];     // Chains linked by pidnext
+  struct proc *sleepq[NSLEEPHASH];    // Sleeping procs by chan, linked by sleepnext
 } ptable;
 
+#define PIDHASH(pid)   (&ptable.pidhash[(uint)(pid) % NPIDHASH])
+#define SLEEPQ(chan)   (&ptable.sleepq[(uint)(chan) % NSLEEPHASH])
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -19,6 +35,19 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static struct proc *pickproc(void);
+static void setrunnable(struct proc *p);
+static void runqdel(struct proc *p);
+static void kickproc(struct proc *p);
+static void unsleep(struct proc *p);
+static void freeproc(struct proc *p);
+static void acctswitch(struct proc *p, uint64 *t);
+static void rtqput(struct cpu *c, struct proc *p);
+static int rtpreempts(struct proc *p, struct cpu *c);
+static void rtcharge(struct proc *p);
+static void rtrefill(struct proc *p, uint64 now);
+static void rtthrottle(void);
+static void dispatch(struct proc *p);
 
 void
 pinit(void)
@@ -27,31 +56,45 @@ pinit(void)
 }
 
 //PAGEBREAK: 32
-// Look in the process table for an UNUSED proc.
-// If found, change state to EMBRYO and initialize
-// state required to run in the kernel.
-// Otherwise return 0.
+// Allocate a proc, change its state to EMBRYO and
+// initialize state required to run in the kernel.
+// Return 0 if there are too many processes or no memory.
 static struct proc*
 allocproc(void)
 {
   struct proc *p;
-  char *sp;
+  char *page, *sp;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
-  release(&ptable.lock);
-  return 0;
+  if(ptable.nproc >= NPROC)
+    goto bad;
+  if(ptable.free == 0){
+    // Carve a fresh page into procs.
+    if((page = kalloc()) == 0)
+      goto bad;
+    for(p = (struct proc*)page; p+1 <= (struct proc*)(page+PGSIZE); p++){
+      p->pidnext = ptable.free;
+      ptable.free = p;
+    }
+  }
+  p = ptable.free;
+  ptable.free = p->pidnext;
+  ptable.nproc++;
 
-found:
+  memset(p, 0, sizeof(*p));
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->leader = p;
+  p->cpumask = ~0;
+  p->pidnext = *PIDHASH(p->pid);
+  *PIDHASH(p->pid) = p;
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(p);
+    release(&ptable.lock);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -71,6 +114,55 @@ found:
   p->context->eip = (uint)forkret;
 
   return p;
+
+bad:
+  release(&ptable.lock);
+  return 0;
+}
+
+// Return p's kernel stack and, unless it is a thread,
+// its address space to the allocator, and p to the
+// free list.  The caller must have taken p off its
+// parent's list of children.
+// The ptable lock must be held.
+static void
+freeproc(struct proc *p)
+{
+  struct proc **pp;
+
+  if(p->kstack)
+    kfree(p->kstack);
+  if(p->pgdir && p->leader == p)
+    freevm(p->pgdir);
+  for(pp = PIDHASH(p->pid); *pp != p; pp = &(*pp)->pidnext)
+    ;
+  *pp = p->pidnext;
+  p->state = UNUSED;
+  p->pidnext = ptable.free;
+  ptable.free = p;
+  ptable.nproc--;
+}
+
+// Return the live process with the given pid, or 0.
+// The ptable lock must be held.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  for(p = *PIDHASH(pid); p; p = p->pidnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
+}
+
+// Add p to its parent's list of children.
+// The ptable lock must be held.
+static void
+addchild(struct proc *p)
+{
+  p->sibling = p->parent->children;
+  p->parent->children = p;
 }
 
 //PAGEBREAK: 32
@@ -99,26 +191,70 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  acquire(&ptable.lock);
+  setrunnable(p);
+  release(&ptable.lock);
+}
+
+// Start a kernel process running fn, which must not return.
+// It has only the kernel's mappings, and is nobody's child.
+void
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0 || (p->pgdir = setupkvm()) == 0)
+    panic("kproc");
+
+  // Have forkret return to fn instead of trapret.
+  *(uint*)(p->context + 1) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->parent = initproc;
+
+  acquire(&ptable.lock);
+  setrunnable(p);
+  release(&ptable.lock);
 }
 
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
+// A process with more than one thread cannot shrink: its
+// other threads may be running on other CPUs with the freed
+// pages in their TLBs, and there is no TLB shootdown.
 int
 growproc(int n)
 {
   uint sz;
+  struct proc *p;
   
+  // Threads share the address space: resize it under
+  // ptable.lock and give all of them the new size.
+  acquire(&ptable.lock);
   sz = proc->sz;
   if(n > 0){
-    if((sz = allocuvm(proc->pgdir, sz, sz + n)) == 0)
+    if((sz = allocuvm(proc->pgdir, sz, sz + n)) == 0){
+      release(&ptable.lock);
       return -1;
+    }
   } else if(n < 0){
-    if((sz = deallocuvm(proc->pgdir, sz, sz + n)) == 0)
+    for(p = proc->leader->children; p; p = p->sibling)
+      if(p->leader == proc->leader && p != proc)
+        break;
+    if(proc != proc->leader || p != 0){
+      release(&ptable.lock);
       return -1;
+    }
+    if((sz = deallocuvm(proc->pgdir, sz, sz + n)) == 0){
+      release(&ptable.lock);
+      return -1;
+    }
   }
-  proc->sz = sz;
-  switchuvm(proc);
+  proc->leader->sz = sz;
+  for(p = proc->leader->children; p; p = p->sibling)
+    if(p->leader == proc->leader)
+      p->sz = sz;
+  release(&ptable.lock);
+  lcr3(v2p(proc->pgdir));  // flush TLB of unmapped pages
   return 0;
 }
 
@@ -137,32 +273,82 @@ fork(void)
 
   // Copy process state from p.
   if((np->pgdir = copyuvm(proc->pgdir, proc->sz)) == 0){
-    kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
     return -1;
   }
   np->sz = proc->sz;
-  np->parent = proc;
+  np->parent = proc->leader;
+  np->cpumask = proc->cpumask;
   *np->tf = *proc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
   for(i = 0; i < NOFILE; i++)
-    if(proc->ofile[i])
-      np->ofile[i] = filedup(proc->ofile[i]);
-  np->cwd = idup(proc->cwd);
+    np->ofile[i] = fileget(&proc->leader->ofile[i]);
+  np->cwd = idup(proc->leader->cwd);
  
   pid = np->pid;
-  np->state = RUNNABLE;
   safestrcpy(np->name, proc->name, sizeof(proc->name));
+  acquire(&ptable.lock);
+  addchild(np);
+  setrunnable(np);
+  release(&ptable.lock);
   return pid;
 }
 
+// Create a thread in the current process, running fn(arg)
+// on the PGSIZE-byte user stack at stack.  It shares the
+// address space, open files and current directory of the
+// process.  Returns the new thread's pid.
+int
+clone(void (*fn)(void*), void *arg, void *stack)
+{
+  struct proc *np;
+  uint sp, ustack[2];
+
+  if((uint)stack + PGSIZE < (uint)stack || (uint)stack + PGSIZE > proc->sz)
+    return -1;
+  if((np = allocproc()) == 0)
+    return -1;
+
+  np->pgdir = proc->pgdir;
+  np->parent = proc->leader;
+  np->leader = proc->leader;
+  np->ustack = stack;
+  np->cpumask = proc->cpumask;
+  *np->tf = *proc->tf;
+
+  sp = (uint)stack + PGSIZE - sizeof(ustack);
+  ustack[0] = 0xffffffff;  // fake return PC
+  ustack[1] = (uint)arg;
+  np->tf->eip = (uint)fn;
+  np->tf->esp = sp;
+  safestrcpy(np->name, proc->name, sizeof(proc->name));
+
+  acquire(&ptable.lock);
+  // If killthreads() has killed us, it is waiting for the
+  // leader's children to die: do not add one behind its back.
+  if(proc->killed || copyout(np->pgdir, sp, ustack, sizeof(ustack)) < 0){
+    freeproc(np);
+    release(&ptable.lock);
+    return -1;
+  }
+  np->sz = proc->sz;  // see growproc
+  addchild(np);
+  setrunnable(np);
+  release(&ptable.lock);
+  return np->pid;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
+// Exiting the group leader kills its other threads;
+// exiting any other thread ends just that thread, which
+// stays a zombie until join() or the leader reaps it.
 void
 exit(void)
 {
@@ -172,29 +358,43 @@ exit(void)
   if(proc == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
-    if(proc->ofile[fd]){
-      fileclose(proc->ofile[fd]);
-      proc->ofile[fd] = 0;
+  if(proc->leader == proc){
+    killthreads();
+
+    // Close all open files.
+    for(fd = 0; fd < NOFILE; fd++){
+      if(proc->ofile[fd]){
+        fileclose(proc->ofile[fd]);
+        proc->ofile[fd] = 0;
+      }
     }
-  }
 
-  iput(proc->cwd);
-  proc->cwd = 0;
+    iput(proc->cwd);
+    proc->cwd = 0;
+  }
 
   acquire(&ptable.lock);
 
-  // Parent might be sleeping in wait().
+  // Give up any real-time reservation.
+  if(proc->rtcpu)
+    proc->rtcpu->rtutil -= proc->rtutil;
+
+  // Parent might be sleeping in wait(), or,
+  // for a thread, the leader in join().
   wakeup1(proc->parent);
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == proc){
+  if(proc->children){
+    for(p = proc->children; ; p = p->sibling){
       p->parent = initproc;
       if(p->state == ZOMBIE)
         wakeup1(initproc);
+      if(p->sibling == 0)
+        break;
     }
+    p->sibling = initproc->children;
+    initproc->children = proc->children;
+    proc->children = 0;
   }
 
   // Jump into the scheduler, never to return.
@@ -208,28 +408,22 @@ exit(void)
 int
 wait(void)
 {
-  struct proc *p;
+  struct proc *p, **pp;
   int havekids, pid;
 
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for zombie children.
+    // Scan through children looking for zombies.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != proc)
+    for(pp = &proc->leader->children; (p = *pp) != 0; pp = &p->sibling){
+      if(p->leader != p)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->state = UNUSED;
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
+        *pp = p->sibling;
+        freeproc(p);
         release(&ptable.lock);
         return pid;
       }
@@ -242,8 +436,79 @@ wait(void)
     }
 
     // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-    sleep(proc, &ptable.lock);  //DOC: wait-sleep
+    sleep(proc->leader, &ptable.lock);  //DOC: wait-sleep
+  }
+}
+
+// Wait for another thread of this process to exit.
+// Return its pid and set *stack to the user stack it
+// was given by clone, or return -1 if there are no
+// other threads.
+int
+join(void **stack)
+{
+  struct proc *p, **pp;
+  int havethreads, pid;
+
+  acquire(&ptable.lock);
+  for(;;){
+    havethreads = 0;
+    for(pp = &proc->leader->children; (p = *pp) != 0; pp = &p->sibling){
+      if(p->leader == p || p == proc)
+        continue;
+      havethreads = 1;
+      if(p->state == ZOMBIE){
+        pid = p->pid;
+        *stack = p->ustack;
+        *pp = p->sibling;
+        freeproc(p);
+        release(&ptable.lock);
+        return pid;
+      }
+    }
+    if(!havethreads || proc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+    sleep(proc->leader, &ptable.lock);
+  }
+}
+
+// Kill the other threads of the current process and wait
+// for them to go away.  Called by the group leader before
+// it gives up the shared address space in exec or exit.
+void
+killthreads(void)
+{
+  struct proc *p, **pp;
+  int n;
+
+  acquire(&ptable.lock);
+  for(;;){
+    n = 0;
+    for(pp = &proc->children; (p = *pp) != 0; ){
+      if(p->leader != proc){
+        pp = &p->sibling;
+        continue;
+      }
+      if(p->state == ZOMBIE){
+        *pp = p->sibling;
+        freeproc(p);
+        continue;
+      }
+      p->killed = 1;
+      if(p->state == SLEEPING)
+        unsleep(p);
+      else if(p->state == RUNNING)
+        kickproc(p);
+      n++;
+      pp = &p->sibling;
+    }
+    if(n == 0)
+      break;
+    sleep(proc, &ptable.lock);
   }
+  release(&ptable.lock);
 }
 
 //PAGEBREAK: 42
@@ -254,6 +519,12 @@ wait(void)
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
+// If there is nothing to run, the CPU halts until an
+// interrupt arrives; setrunnable() sends a reschedule IPI
+// to wake it up as soon as there is work.
+// Processes giving up the CPU switch straight to the next
+// one when there is one (see sched), so the scheduler loop
+// only runs when the CPU starts or runs out of work.
 void
 scheduler(void)
 {
@@ -263,36 +534,67 @@ scheduler(void)
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
-        continue;
+    if((p = pickproc()) == 0){
+      cpu->idle = 1;
+      release(&ptable.lock);
 
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-      proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
-      swtch(&cpu->scheduler, proc->context);
-      switchkvm();
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      proc = 0;
+      // Halt unless setrunnable() cleared idle after we
+      // dropped the lock; its IPI may have arrived already.
+      cli();
+      timerslice(0);
+      if(cpu->idle)
+        stihlt();
+      cpu->idle = 0;
+      continue;
     }
-    release(&ptable.lock);
 
+    // Switch to chosen process.  It is the process's job
+    // to release ptable.lock and then reacquire it
+    // before jumping back to us.
+    dispatch(p);
+    swtch(&cpu->scheduler, proc->context);
+    switchkvm();
+    cpu->slice = 0;
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    proc = 0;
+    release(&ptable.lock);
   }
 }
 
-// Enter scheduler.  Must hold only ptable.lock
-// and have changed proc->state.
+// Make p the process running on this CPU.
+// The ptable lock must be held.
+static void
+dispatch(struct proc *p)
+{
+  if(p->lastcpu && p->lastcpu != cpu)
+    p->migrations++;
+  p->lastcpu = cpu;
+  acctswitch(p, &p->waittime);
+  proc = p;
+  switchuvm(p);
+  p->state = RUNNING;
+  cpu->preempt = 0;
+  if(p->rtperiod){
+    p->rtstart = nsecs();
+    timerslice(p->rtbudget ? p->rtbudget : 1);
+  } else
+    timerslice(cpu->nrun > 0 ? NSPERTICK : 0);
+}
+
+// Give up the CPU.  Must hold only ptable.lock
+// and have changed proc->state.  Switches directly
+// to the next process to run, if there is one,
+// without going through the scheduler loop; a
+// process that yields with nobody else waiting
+// just keeps running.  Otherwise enters scheduler.
 void
 sched(void)
 {
   int intena;
+  struct proc *p, *next;
 
   if(!holding(&ptable.lock))
     panic("sched ptable.lock");
@@ -302,8 +604,18 @@ sched(void)
     panic("sched running");
   if(readeflags()&FL_IF)
     panic("sched interruptible");
+  acctswitch(proc, &proc->stime);
+  if(proc->rtperiod)
+    rtcharge(proc);
   intena = cpu->intena;
-  swtch(&proc->context, cpu->scheduler);
+  p = proc;
+  if((next = pickproc()) == p)
+    dispatch(p);
+  else if(next){
+    dispatch(next);
+    swtch(&p->context, next->context);
+  } else
+    swtch(&p->context, cpu->scheduler);
   cpu->intena = intena;
 }
 
@@ -311,8 +623,11 @@ sched(void)
 void
 yield(void)
 {
+  if(proc->rtperiod)
+    rtthrottle();
   acquire(&ptable.lock);  //DOC: yieldlock
-  proc->state = RUNNABLE;
+  proc->nivcsw++;
+  setrunnable(proc);
   sched();
   release(&ptable.lock);
 }
@@ -362,6 +677,9 @@ sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   proc->chan = chan;
   proc->state = SLEEPING;
+  proc->sleepnext = *SLEEPQ(chan);
+  *SLEEPQ(chan) = proc;
+  proc->nvcsw++;
   sched();
 
   // Tidy up.
@@ -375,16 +693,458 @@ sleep(void *chan, struct spinlock *lk)
 }
 
 //PAGEBREAK!
+// Run queues and CPU affinity.
+//
+// Each CPU has a FIFO queue of RUNNABLE processes.  A
+// process that becomes runnable goes back to the CPU it
+// last ran on, whose caches and TLB may still hold its
+// working set, unless some other CPU it is allowed on is
+// idle or has a clearly shorter queue.  A CPU with nothing
+// queued takes work from CPUs that are busy running
+// something else.  p->cpumask, set by setaffinity(), is
+// the hard limit on where p may run; p->migrations counts
+// the times it has moved.
+//
+// The ptable lock protects the queues.
+
+#define CPUBIT(c) (1 << ((c) - cpus))
+
+static void
+runqput(struct cpu *c, struct proc *p)
+{
+  p->runnext = 0;
+  p->rqcpu = c;
+  if(c->runq)
+    c->runqtail->runnext = p;
+  else
+    c->runq = p;
+  c->runqtail = p;
+  c->nrun++;
+}
+
+// Take the first process on c's queue that may run
+// on this CPU off the queue.
+static struct proc*
+runqget(struct cpu *c)
+{
+  struct proc *p, **pp, *prev;
+
+  prev = 0;
+  for(pp = &c->runq; (p = *pp) != 0; pp = &p->runnext){
+    if(p->cpumask & CPUBIT(cpu)){
+      *pp = p->runnext;
+      if(c->runqtail == p)
+        c->runqtail = prev;
+      c->nrun--;
+      p->rqcpu = 0;
+      return p;
+    }
+    prev = p;
+  }
+  return 0;
+}
+
+static void
+runqdel(struct proc *p)
+{
+  struct cpu *c;
+  struct proc **pp, *prev;
+
+  c = p->rqcpu;
+  prev = 0;
+  for(pp = &c->runq; *pp != p; pp = &(*pp)->runnext)
+    prev = *pp;
+  *pp = p->runnext;
+  if(c->runqtail == p)
+    c->runqtail = prev;
+  c->nrun--;
+  p->rqcpu = 0;
+}
+
+// Choose the next process for this CPU to run.
+// Real-time processes come first.
+static struct proc*
+pickproc(void)
+{
+  struct cpu *c;
+  struct proc *p;
+
+  if((p = cpu->rtq) != 0){
+    cpu->rtq = p->runnext;
+    p->rqcpu = 0;
+    return p;
+  }
+  if((p = runqget(cpu)) != 0)
+    return p;
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c != cpu && c->proc && (p = runqget(c)) != 0)
+      return p;
+  return 0;
+}
+
+// Choose the run queue for p.
+static struct cpu*
+pickcpu(struct proc *p)
+{
+  struct cpu *c, *home, *best;
+  int load, homeload, bestload;
+
+  home = best = 0;
+  homeload = bestload = 0;
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(!(p->cpumask & CPUBIT(c)))
+      continue;
+    load = c->nrun + (c->proc != 0 && c->proc != p);
+    if(c == p->lastcpu){
+      home = c;
+      homeload = load;
+    }
+    if(best == 0 || load < bestload){
+      best = c;
+      bestload = load;
+    }
+  }
+  if(home && (homeload == bestload || (bestload > 0 && homeload <= bestload+1)))
+    return home;
+  return best;
+}
+
+// Mark p RUNNABLE and queue it.  If its CPU is halted in
+// scheduler() for lack of work, send it a reschedule IPI
+// so that it picks p up right away.  If p is real-time and
+// should run before the CPU's current process, make that
+// process yield; otherwise, if the current process has no
+// time slice, make it start one so that p gets a turn.
+// The ptable lock must be held.
+static void
+setrunnable(struct proc *p)
+{
+  struct cpu *c;
+
+  if(p->state != RUNNING){
+    p->tstamp = nsecs();  // start of wait; see acctswitch
+    if(p->rtperiod)
+      rtrefill(p, p->tstamp);
+  }
+  p->state = RUNNABLE;
+  if(p->rtperiod){
+    c = p->rtcpu;
+    rtqput(c, p);
+  } else {
+    c = pickcpu(p);
+    runqput(c, p);
+  }
+  if(c->idle){
+    c->idle = 0;
+    if(c != cpu)
+      lapicipi(c->id, T_IRQ0 + IRQ_RESCHED);
+  } else if(rtpreempts(p, c)){
+    c->preempt = 1;
+    if(c != cpu)
+      lapicipi(c->id, T_IRQ0 + IRQ_RESCHED);
+  } else if(c->proc && c->proc != p && c->slice == 0){
+    if(c == cpu)
+      timerslice(NSPERTICK);
+    else
+      lapicipi(c->id, T_IRQ0 + IRQ_RESCHED);
+  }
+}
+
+// Called on the way back from a trap when a reschedule IPI
+// arrived or preempt is set: give up the CPU if a real-time
+// process is waiting for it or if proc may no longer run
+// here, or start a time slice if others are now waiting.
+void
+resched(void)
+{
+  if(cpu->preempt || !(proc->cpumask & CPUBIT(cpu))){
+    cpu->preempt = 0;
+    yield();
+  } else if(cpu->nrun && cpu->slice == 0)
+    timerslice(NSPERTICK);
+}
+
+// Restrict the process with the given pid, or the current
+// process if pid is 0, to the CPUs whose bits are set in
+// mask.  Returns the old mask.  Real-time processes stay
+// on the CPU setrt() reserved for them.
+int
+setaffinity(int pid, uint mask)
+{
+  struct proc *p;
+  uint old;
+  int moveself;
+
+  mask &= (1 << ncpu) - 1;
+  if(mask == 0)
+    return -1;
+  acquire(&ptable.lock);
+  if((p = pid == 0 ? proc : findproc(pid)) == 0 || p->rtperiod){
+    release(&ptable.lock);
+    return -1;
+  }
+  old = p->cpumask & ((1 << ncpu) - 1);
+  p->cpumask = mask;
+  if(p->state == RUNNABLE && !(mask & CPUBIT(p->rqcpu))){
+    runqdel(p);
+    setrunnable(p);
+  } else if(p->state == RUNNING && p != proc)
+    kickproc(p);
+  moveself = p == proc && !(mask & CPUBIT(cpu));
+  release(&ptable.lock);
+  if(moveself)
+    yield();
+  return old;
+}
+
+//PAGEBREAK!
+// Earliest-deadline-first real-time scheduling.
+//
+// setrt() reserves runtime ns of CPU time in every period ns
+// for the current process.  Admission control places the
+// process on one CPU that it is allowed on and whose
+// reservations, including this one, add up to at most
+// RTLIMIT of it; the rest is left for ordinary processes.
+// The process then runs only on that CPU, which runs it
+// ahead of all of them: each CPU keeps its RUNNABLE
+// real-time processes on rtq, ordered by deadline, and
+// pickproc() takes the earliest first.  A real-time process
+// that becomes runnable with an earlier deadline than the
+// one running preempts it at once.
+//
+// Each process gets a budget of runtime ns to use by its
+// deadline, enforced with the time slice timer.  A process
+// that runs out of budget has missed its deadline: it is
+// kept off the CPU until then and given a fresh budget and
+// deadline, so that an overrunning process cannot take
+// time reserved for others.  A process that wakes up keeps
+// its budget and deadline only if it could use the rest of
+// the budget by the deadline without exceeding its share
+// (the constant bandwidth server rule); otherwise it starts
+// a new period.  Periodic work calls rtwait() at the end of
+// each job to sleep until the next period, and a job that
+// ends after its deadline counts as a miss too.  On a CPU
+// whose reservations fit, no deadline is missed unless a
+// process overruns its own budget.
+//
+// The ptable lock protects the reservations and queues.
+
+#define RTSCALE   (1 << 16)              // Share of a whole CPU
+#define RTLIMIT   (RTSCALE / 10 * 9)     // Share reservable per CPU
+#define RTMINRUN  100                    // Shortest runtime, us
+#define RTMAXPER  1000000                // Longest period, us
+
+// Queue p on c's real-time queue, after those with
+// earlier or equal deadlines.
+static void
+rtqput(struct cpu *c, struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &c->rtq; *pp && (*pp)->rtdeadline <= p->rtdeadline; pp = &(*pp)->runnext)
+    ;
+  p->runnext = *pp;
+  *pp = p;
+  p->rqcpu = c;
+}
+
+// Should real-time process p, just queued on c,
+// take c from the process running there?
+static int
+rtpreempts(struct proc *p, struct cpu *c)
+{
+  struct proc *q;
+
+  q = c->proc;
+  if(!p->rtperiod || q == 0 || q == p)
+    return 0;
+  return !q->rtperiod || p->rtdeadline < q->rtdeadline;
+}
+
+// Charge p's running time since p->rtstart to its budget.
+static void
+rtcharge(struct proc *p)
+{
+  uint64 now, used;
+
+  now = nsecs();
+  used = now - p->rtstart;
+  p->rtbudget = used < p->rtbudget ? p->rtbudget - used : 0;
+  p->rtstart = now;
+}
+
+// Give p a new budget and deadline unless the rest of its
+// budget can be used by its deadline within its share.
+// Products fit in 64 bits since periods are at most 1s.
+static void
+rtrefill(struct proc *p, uint64 now)
+{
+  if(p->rtdeadline <= now ||
+     p->rtbudget * p->rtperiod > (p->rtdeadline - now) * p->rtruntime){
+    p->rtdeadline = now + p->rtperiod;
+    p->rtbudget = p->rtruntime;
+  }
+}
+
+// The current real-time process is being preempted.
+// If it has used up its budget, count a missed deadline
+// and keep it off the CPU until the deadline.
+static void
+rtthrottle(void)
+{
+  uint64 dl;
+
+  acquire(&ptable.lock);
+  rtcharge(proc);
+  dl = proc->rtdeadline;
+  if(proc->rtbudget > 0){
+    release(&ptable.lock);
+    return;
+  }
+  proc->rtmissed++;
+  release(&ptable.lock);
+
+  sleepuntil(dl);
+  acquire(&ptable.lock);
+  rtrefill(proc, nsecs());
+  release(&ptable.lock);
+}
+
+// Reserve runtime us of CPU time in every period us for
+// the current process, or make it an ordinary process
+// again if runtime is 0.  Returns -1 if the reservation
+// is malformed or no allowed CPU has room for it.
+int
+setrt(uint runtime, uint period)
+{
+  struct cpu *c, *best;
+  uint util;
+  int move;
+
+  if(runtime == 0){
+    acquire(&ptable.lock);
+    if(proc->rtcpu)
+      proc->rtcpu->rtutil -= proc->rtutil;
+    proc->rtcpu = 0;
+    proc->rtutil = 0;
+    proc->rtruntime = proc->rtperiod = 0;
+    release(&ptable.lock);
+    return 0;
+  }
+  if(runtime < RTMINRUN || runtime > period || period > RTMAXPER)
+    return -1;
+  util = divl((uint64)runtime * RTSCALE + period - 1, period);
+
+  acquire(&ptable.lock);
+  if(proc->rtcpu)
+    proc->rtcpu->rtutil -= proc->rtutil;
+  best = 0;
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(!(proc->cpumask & CPUBIT(c)) || c->rtutil + util > RTLIMIT)
+      continue;
+    if(best == 0 || c->rtutil < best->rtutil || (c->rtutil == best->rtutil && c == cpu))
+      best = c;
+  }
+  if(best == 0){
+    if(proc->rtcpu)
+      proc->rtcpu->rtutil += proc->rtutil;
+    release(&ptable.lock);
+    return -1;
+  }
+  best->rtutil += util;
+  proc->rtcpu = best;
+  proc->rtutil = util;
+  proc->rtruntime = runtime * 1000ULL;
+  proc->rtperiod = period * 1000ULL;
+  proc->rtstart = nsecs();
+  proc->rtdeadline = proc->rtstart + proc->rtperiod;
+  proc->rtbudget = proc->rtruntime;
+  move = best != cpu;
+  if(!move)
+    timerslice(proc->rtbudget);
+  release(&ptable.lock);
+  if(move)
+    yield();
+  return 0;
+}
+
+// The current real-time process has finished its job for
+// this period: sleep until the next period begins, and
+// return the number of deadlines missed so far.  A job
+// that finished late starts the next period right away.
+int
+rtwait(void)
+{
+  uint64 dl, now;
+  int n;
+
+  if(proc->rtperiod == 0)
+    return -1;
+  now = nsecs();
+  acquire(&ptable.lock);
+  dl = proc->rtdeadline;
+  if(now > dl){
+    proc->rtmissed++;
+    dl = now;
+  }
+  release(&ptable.lock);
+  if(sleepuntil(dl) < 0)
+    return -1;
+
+  // Periods follow on from each other, whenever the
+  // process happened to be woken up.
+  acquire(&ptable.lock);
+  proc->rtstart = nsecs();
+  proc->rtdeadline = dl + proc->rtperiod;
+  proc->rtbudget = proc->rtruntime;
+  timerslice(proc->rtbudget);
+  n = proc->rtmissed;
+  release(&ptable.lock);
+  return n;
+}
+
+//PAGEBREAK!
+// Interrupt the CPU running p, so that p notices it has
+// been killed: a CPU with no time slice may not take
+// another timer interrupt for a long time.
+// The ptable lock must be held.
+static void
+kickproc(struct proc *p)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c->proc == p && c != cpu)
+      lapicipi(c->id, T_IRQ0 + IRQ_RESCHED);
+}
+
 // Wake up all processes sleeping on chan.
 // The ptable lock must be held.
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
+  struct proc *p, **pp;
+
+  for(pp = SLEEPQ(chan); (p = *pp) != 0; ){
+    if(p->chan == chan){
+      *pp = p->sleepnext;
+      setrunnable(p);
+    } else
+      pp = &p->sleepnext;
+  }
+}
+
+// Wake up p, which is SLEEPING, whatever it sleeps on.
+// The ptable lock must be held.
+static void
+unsleep(struct proc *p)
+{
+  struct proc **pp;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  for(pp = SLEEPQ(p->chan); *pp != p; pp = &(*pp)->sleepnext)
+    ;
+  *pp = p->sleepnext;
+  setrunnable(p);
 }
 
 // Wake up all processes sleeping on chan.
@@ -405,18 +1165,86 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
+  if((p = findproc(pid)) == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  p->killed = 1;
+  // Wake process from sleep if necessary.
+  if(p->state == SLEEPING)
+    unsleep(p);
+  else if(p->state == RUNNING)
+    kickproc(p);
+  release(&ptable.lock);
+  return 0;
+}
+
+//PAGEBREAK!
+// CPU accounting.  p->tstamp marks the start of the current
+// stretch of user, kernel or runnable-but-waiting time, and
+// each of the hooks below ends one stretch and starts the next:
+// trap entry from user space, return to user space, switching
+// away from a process, and dispatching it (which ends the wait
+// that setrunnable started).  Time asleep is not counted.
+
+// Charge the time since p->tstamp to *t.
+static void
+acctswitch(struct proc *p, uint64 *t)
+{
+  uint64 now;
+
+  now = nsecs();
+  *t += now - p->tstamp;
+  p->tstamp = now;
+}
+
+// Entering the kernel from user space.
+void
+acctenter(void)
+{
+  acctswitch(proc, &proc->utime);
+}
+
+// Returning to user space.
+void
+acctleave(void)
+{
+  acctswitch(proc, &proc->stime);
+}
+
+// Fill in up to n procstats, one per process, and
+// return how many were filled in.  ps must be mapped
+// in the current address space: holding ptable.lock
+// keeps growproc from unmapping it.
+int
+getprocs(struct procstat *ps, int n)
+{
+  struct proc *p;
+  int h, i;
+
+  acquire(&ptable.lock);
+  i = 0;
+  for(h = 0; h < NPIDHASH && i < n; h++){
+    for(p = ptable.pidhash[h]; p && i < n; p = p->pidnext, i++){
+      ps[i].pid = p->pid;
+      ps[i].ppid = p->parent ? p->parent->pid : 0;
+      ps[i].state = p->state;
+      ps[i].cpu = p->lastcpu ? p->lastcpu - cpus : -1;
+      ps[i].sz = p->sz;
+      ps[i].uticks = divl(p->utime, NSPERTICK);
+      ps[i].kticks = divl(p->stime, NSPERTICK);
+      ps[i].waitticks = divl(p->waittime, NSPERTICK);
+      ps[i].nvcsw = p->nvcsw;
+      ps[i].nivcsw = p->nivcsw;
+      ps[i].migrations = p->migrations;
+      ps[i].rtruntime = divl(p->rtruntime, 1000);
+      ps[i].rtperiod = divl(p->rtperiod, 1000);
+      ps[i].rtmissed = p->rtmissed;
+      safestrcpy(ps[i].name, p->name, sizeof(ps[i].name));
     }
   }
   release(&ptable.lock);
-  return -1;
+  return i;
 }
 
 //PAGEBREAK: 36
@@ -434,25 +1262,27 @@ procdump(void)
   [RUNNING]   "run   ",
   [ZOMBIE]    "zombie"
   };
-  int i;
+  int i, h;
   struct proc *p;
   char *state;
   uint pc[10];
   
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->state == UNUSED)
-      continue;
-    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-      state = states[p->state];
-    else
-      state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
-    if(p->state == SLEEPING){
-      getcallerpcs((uint*)p->context->ebp+2, pc);
-      for(i=0; i<10 && pc[i] != 0; i++)
-        cprintf(" %p", pc[i]);
+  for(h = 0; h < NPIDHASH; h++){
+    for(p = ptable.pidhash[h]; p; p = p->pidnext){
+      if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
+        state = states[p->state];
+      else
+        state = "???";
+      cprintf("%d %s %s", p->pid, state, p->name);
+      if(p->lastcpu)
+        cprintf(" cpu%d mig %d", p->lastcpu - cpus, p->migrations);
+      if(p->state == SLEEPING){
+        getcallerpcs((uint*)p->context->ebp+2, pc);
+        for(i=0; i<10 && pc[i] != 0; i++)
+          cprintf(" %p", pc[i]);
+      }
+      cprintf("\n");
     }
-    cprintf("\n");
   }
 }
 
@@ -10,6 +10,14 @@ struct cpu {
   volatile uint started;       // Has the CPU started?
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
+  volatile int idle;           // Halted in scheduler, waiting for an IPI?
+  uint64 slice;                // TSC deadline of current time slice, or 0
+  struct proc *runq;           // RUNNABLE processes queued for this CPU
+  struct proc *runqtail;
+  int nrun;                    // Length of runq
+  struct proc *rtq;            // RUNNABLE real-time processes, by deadline
+  uint rtutil;                 // Share reserved by real-time processes
+  volatile int preempt;        // Running process must yield at trap return
   
   // Cpu-local storage variables; see below
   struct cpu *cpu;
@@ -59,15 +67,46 @@ struct proc {
   enum procstate state;        // Process state
   volatile int pid;            // Process ID
   struct proc *parent;         // Parent process
+  struct proc *children;       // Its children, linked by sibling
+  struct proc *sibling;        // Next child of parent
+  struct proc *pidnext;        // Next in pid hash chain or on free list
+  struct proc *sleepnext;      // Next in sleep queue, if SLEEPING
+  struct proc *leader;         // Thread group leader; self unless a thread
+  struct proc *runnext;        // Next on run queue, if RUNNABLE
+  struct cpu *rqcpu;           // Whose run queue it is on, if RUNNABLE
+  struct cpu *lastcpu;         // CPU it last ran on, or 0
+  uint cpumask;                // CPUs it may run on, by index in cpus[]
+  uint migrations;             // Times run on a CPU other than lastcpu
+  uint64 tstamp;               // Start of current accounting period, ns
+  uint64 utime;                // Time in user space, ns
+  uint64 stime;                // Time in the kernel, ns
+  uint64 waittime;             // Time RUNNABLE, ns
+  uint nvcsw;                  // Switches by sleeping
+  uint nivcsw;                 // Switches by preemption
+  struct cpu *rtcpu;           // CPU reserved on, if real-time
+  uint rtutil;                 // Share of rtcpu reserved
+  uint64 rtruntime;            // Run time reserved per period, ns; 0 if not real-time
+  uint64 rtperiod;             // Reservation period, ns
+  uint64 rtdeadline;           // Deadline of the current budget, ns
+  uint64 rtbudget;             // Run time left before rtdeadline, ns
+  uint64 rtstart;              // When rtbudget was last charged
+  uint rtmissed;               // Deadlines missed
+  void *ustack;                // User stack of a thread, from clone
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct file *ofile[NOFILE];  // Open files (use leader's)
+  struct inode *cwd;           // Current directory (use leader's)
   char name[16];               // Process name (debugging)
 };
 
+// Threads made by clone() share the address space, open files
+// and current directory of their group leader: pgdir and sz are
+// copied into each thread, and ofile and cwd are used only in
+// the leader.  Each thread has its own kernel stack, trap frame
+// and user stack.
+
 // Process memory is laid out contiguously, low addresses first:
 //   text
 //   original data and bss
@@ -0,0 +1,19 @@
+// Per-process statistics, as returned by getprocs().
+// Times are in clock ticks.
+struct procstat {
+  int pid;
+  int ppid;
+  int state;         // enum procstate in proc.h
+  int cpu;           // CPU it last ran on, or -1
+  uint sz;           // Size of process memory (bytes)
+  uint uticks;       // Time running in user space
+  uint kticks;       // Time running in the kernel
+  uint waitticks;    // Time runnable but waiting for a CPU
+  uint nvcsw;        // Voluntary context switches (sleeps)
+  uint nivcsw;       // Involuntary context switches (preemptions)
+  uint migrations;   // Moves to a different CPU
+  uint rtruntime;    // Real-time reservation in us per period, or 0
+  uint rtperiod;     // Real-time period in us
+  uint rtmissed;     // Real-time deadlines missed
+  char name[16];
+};
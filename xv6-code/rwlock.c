@@ -0,0 +1,72 @@
+// Reader-writer spin locks.
+//
+// Readers only need to add themselves to the count, so
+// lookups in read-mostly tables run in parallel on all
+// CPUs; a writer announces itself and then waits for the
+// readers already inside to leave.  Like spin locks, they
+// are held with interrupts off and must not be held across
+// sleep.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "rwlock.h"
+
+void
+initrwlock(struct rwlock *rw, char *name)
+{
+  rw->name = name;
+  rw->cnt = 0;
+}
+
+void
+acquireread(struct rwlock *rw)
+{
+  uint v;
+
+  pushcli();
+  for(;;){
+    v = rw->cnt;
+    if(!(v & RW_WRITER) && cmpxchg(&rw->cnt, v, v+1) == v)
+      break;
+    pause();
+  }
+}
+
+void
+releaseread(struct rwlock *rw)
+{
+  if((rw->cnt & ~RW_WRITER) == 0)
+    panic("releaseread");
+  xadd(&rw->cnt, -1);
+  popcli();
+}
+
+void
+acquirewrite(struct rwlock *rw)
+{
+  uint v;
+
+  pushcli();
+  for(;;){
+    v = rw->cnt;
+    if(!(v & RW_WRITER) && cmpxchg(&rw->cnt, v, v|RW_WRITER) == v)
+      break;
+    pause();
+  }
+  while(rw->cnt != RW_WRITER)
+    pause();
+}
+
+void
+releasewrite(struct rwlock *rw)
+{
+  if(rw->cnt != RW_WRITER)
+    panic("releasewrite");
+  xchg(&rw->cnt, 0);
+  popcli();
+}
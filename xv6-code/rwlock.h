@@ -0,0 +1,10 @@
+// Reader-writer spin lock: any number of readers, or one
+// writer.  A writer that is waiting keeps new readers out,
+// so that a stream of readers cannot starve it.
+struct rwlock {
+  volatile uint cnt;   // Readers holding it, plus RW_WRITER
+                       // if a writer holds or is waiting for it
+  char *name;          // Name of lock.
+};
+
+#define RW_WRITER 0x80000000
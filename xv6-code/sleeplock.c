@@ -0,0 +1,66 @@
+// Sleeping locks.
+//
+// Each sleep lock has its own spinlock, held only for a few
+// instructions at a time, and waiters sleep on the lock
+// itself, so locking one buffer or inode does not touch
+// anything shared with the others.  A release with nobody
+// waiting does not call wakeup at all.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+
+void
+initsleeplock(struct sleeplock *lk, char *name)
+{
+  initlock(&lk->lk, name);
+  lk->name = name;
+  lk->locked = 0;
+  lk->nwait = 0;
+  lk->pid = 0;
+}
+
+// Acquire the lock, sleeping until it is free.
+void
+acquiresleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while(lk->locked){
+    lk->nwait++;
+    sleep(lk, &lk->lk);
+    lk->nwait--;
+  }
+  lk->locked = 1;
+  lk->pid = proc->pid;
+  release(&lk->lk);
+}
+
+// Release the lock and wake up any waiters.
+void
+releasesleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->locked = 0;
+  lk->pid = 0;
+  if(lk->nwait)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Does the current process hold the lock?
+int
+holdingsleep(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = lk->locked && lk->pid == proc->pid;
+  release(&lk->lk);
+  return r;
+}
@@ -0,0 +1,12 @@
+// Long-term lock for processes: a process that finds it
+// held sleeps instead of spinning, and may itself sleep
+// while holding it (e.g. waiting for the disk).
+struct sleeplock {
+  uint locked;        // Is the lock held?
+  uint nwait;         // Processes sleeping for it
+  struct spinlock lk; // Protects this sleep lock
+  
+  // For debugging:
+  char *name;         // Name of lock.
+  int pid;            // Process holding the lock.
+};
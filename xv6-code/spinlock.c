@@ -8,44 +8,81 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "lockstat.h"
 
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+  lk->class = findlockclass(name);
 }
 
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 // Holding a lock for a long time may cause
 // other CPUs to waste time spinning to acquire it.
+// Waiters only read owner while they spin, so the
+// lock's cache line moves only when it changes hands,
+// and each waits in proportion to how many are ahead.
 void
 acquire(struct spinlock *lk)
 {
+  uint t, ahead;
+  uint64 t0;
+  struct lockcpu *s;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
+  // The xadd is atomic.
   // It also serializes, so that reads after acquire are not
   // reordered before it. 
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  t = xadd(&lk->next, 1);
+  t0 = 0;
+  if(t != lk->owner){
+    t0 = rdtsc();
+    while((ahead = t - lk->owner) != 0){
+      while(ahead-- > 0)
+        pause();
+    }
+  }
 
   // Record info about lock acquisition for debugging.
   lk->cpu = cpu;
   getcallerpcs(&lk, lk->pcs);
+
+  lk->tacquire = rdtsc();
+  if(lk->class){
+    s = &lk->class->cpu[cpu - cpus];
+    s->acquires++;
+    if(t0){
+      s->contended++;
+      s->spin += lk->tacquire - t0;
+    }
+  }
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  uint64 hold;
+  struct lockcpu *s;
+
   if(!holding(lk))
     panic("release");
 
+  if(lk->class){
+    hold = rdtsc() - lk->tacquire;
+    s = &lk->class->cpu[cpu - cpus];
+    if(hold > s->maxhold)
+      s->maxhold = hold;
+  }
+
   lk->pcs[0] = 0;
   lk->cpu = 0;
 
@@ -55,10 +92,11 @@ release(struct spinlock *lk)
   // any order, which implies we need to serialize here.
   // But the 2007 Intel 64 Architecture Memory Ordering White
   // Paper says that Intel 64 and IA-32 will not move a load
-  // after a store. So lock->locked = 0 would work here.
+  // after a store. So lock->owner++ would work here.
   // The xchg being asm volatile ensures gcc emits it after
   // the above assignments (and after the critical section).
-  xchg(&lk->locked, 0);
+  // Only the holder writes owner.
+  xchg(&lk->owner, lk->owner + 1);
 
   popcli();
 }
@@ -85,7 +123,7 @@ getcallerpcs(void *v, uint pcs[])
 int
 holding(struct spinlock *lock)
 {
-  return lock->locked && lock->cpu == cpu;
+  return lock->owner != lock->next && lock->cpu == cpu;
 }
 
 
@@ -115,3 +153,79 @@ popcli(void)
     sti();
 }
 
+//PAGEBREAK!
+// Lock statistics.  Locks are counted by name, so that, say,
+// all pipe locks show up as one entry; initlock() and
+// initmutex() find or make the entry.  The counters are
+// kept per CPU and only changed by their CPU with interrupts
+// off, so updating them needs no atomic instructions.
+// Times are in TSC cycles.  Locks past the first NLOCKNAME
+// names are not counted.
+
+static struct lockclass lockclass[NLOCKNAME];
+static uint nlockclass;
+static uint classlock;  // Protects the above; a bare xchg lock,
+                        // since initlock runs before cpu is set up.
+
+// Interrupts are off while classlock is held, with eflags
+// saved rather than pushcli(), for the same reason: a holder
+// preempted on this CPU would leave a caller that has them
+// off already, such as one holding a spinlock, spinning.
+struct lockclass*
+findlockclass(char *name)
+{
+  struct lockclass *c;
+  uint eflags;
+
+  eflags = readeflags();
+  cli();
+  while(xchg(&classlock, 1) != 0)
+    ;
+  for(c = lockclass; c < lockclass+nlockclass; c++)
+    if(c->name == name || strncmp(c->name, name, LOCKNAMESZ) == 0)
+      break;
+  if(c == lockclass+NLOCKNAME)
+    c = 0;
+  else {
+    if(c == lockclass+nlockclass){
+      c->name = name;
+      nlockclass++;
+    }
+    c->ninit++;
+  }
+  xchg(&classlock, 0);
+  if(eflags & FL_IF)
+    sti();
+  return c;
+}
+
+// Fill in up to n lockstats, one per lock name, and
+// return how many were filled in.
+int
+lockstat(struct lockstat *ls, int n)
+{
+  struct lockclass *c;
+  struct lockcpu *s;
+  int i, nclass;
+
+  while(xchg(&classlock, 1) != 0)
+    ;
+  nclass = nlockclass;
+  xchg(&classlock, 0);
+  for(i = 0; i < n && i < nclass; i++){
+    c = &lockclass[i];
+    memset(&ls[i], 0, sizeof(ls[i]));
+    safestrcpy(ls[i].name, c->name, sizeof(ls[i].name));
+    ls[i].ninit = c->ninit;
+    for(s = c->cpu; s < c->cpu+ncpu; s++){
+      ls[i].acquires += s->acquires;
+      ls[i].contended += s->contended;
+      ls[i].spin += s->spin;
+      ls[i].sleeps += s->sleeps;
+      ls[i].handoffs += s->handoffs;
+      if(s->maxhold > ls[i].maxhold)
+        ls[i].maxhold = s->maxhold;
+    }
+  }
+  return i;
+}
@@ -1,11 +1,35 @@
 // Mutual exclusion lock.
+// A ticket lock: acquire() takes the next ticket and waits
+// until owner reaches it, so CPUs get the lock in the
+// order they asked for it.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  volatile uint next;   // Next ticket to hand out
+  volatile uint owner;  // Ticket now holding the lock
   
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+
+  // For lockstat:
+  struct lockclass *class;  // Statistics for locks of this name
+  uint64 tacquire;          // TSC when acquired
+};
+
+// Statistics for the locks with one name, per CPU;
+// see spinlock.c and lockstat.h.
+struct lockcpu {
+  uint acquires;
+  uint contended;
+  uint64 spin;
+  uint64 maxhold;
+  uint sleeps;
+  uint handoffs;
 };
 
+struct lockclass {
+  char *name;
+  uint ninit;
+  struct lockcpu cpu[NCPU];
+};
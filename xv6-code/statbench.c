@@ -0,0 +1,64 @@
+// File name lookup benchmark.  Runs 1, 2, 4 and 8 processes,
+// each pinned to its own CPU, that stat() and open() a file
+// as fast as they can: a path lookup in the inode and buffer
+// caches, which should scale with the number of CPUs.
+// Prints the total rate and each process's count.
+// usage: statbench [ms]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define MAXW 8
+
+// Look up /README 32 times.
+int
+lookups(void)
+{
+  struct stat st;
+  int i, f;
+
+  for(i = 0; i < 16; i++){
+    if(stat("/README", &st) < 0 || (f = open("/README", O_RDONLY)) < 0){
+      printf(2, "statbench: cannot find /README\n");
+      exit();
+    }
+    close(f);
+  }
+  return 32;
+}
+
+void
+run(int nw, int ms)
+{
+  uint n[MAXW], total;
+  int i;
+
+  total = benchrun(nw, ms, lookups, n);
+  printf(1, "%d cpus: %d lookups/ms:", nw, total / ms);
+  for(i = 0; i < nw; i++)
+    printf(1, " %d", n[i]);
+  printf(1, "\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ms, ncpu, nw;
+
+  ms = argc > 1 ? atoi(argv[1]) : 1000;
+  if(ms <= 0){
+    printf(2, "usage: statbench [ms]\n");
+    exit();
+  }
+  ncpu = ncpus();
+  for(nw = 1; nw <= MAXW; nw *= 2){
+    if(nw > ncpu){
+      printf(1, "%d cpus: only %d available\n", nw, ncpu);
+      continue;
+    }
+    run(nw, ms);
+  }
+  exit();
+}
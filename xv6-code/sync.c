@@ -0,0 +1,13 @@
+// Commit everything written so far to disk.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+int
+main(void)
+{
+  if(sync() < 0)
+    printf(2, "sync failed\n");
+  exit();
+}
@@ -98,6 +98,22 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_clock_gettime(void);
+extern int sys_nanosleep(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_futex_wait(void);
+extern int sys_futex_wake(void);
+extern int sys_setaffinity(void);
+extern int sys_getprocs(void);
+extern int sys_setrt(void);
+extern int sys_rtwait(void);
+extern int sys_lockstat(void);
+extern int sys_bcachectl(void);
+extern int sys_bcachestat(void);
+extern int sys_sync(void);
+extern int sys_fsync(void);
+extern int sys_bcacheinval(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -121,6 +137,22 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_clock_gettime] sys_clock_gettime,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_getprocs] sys_getprocs,
+[SYS_setrt]   sys_setrt,
+[SYS_rtwait]  sys_rtwait,
+[SYS_lockstat] sys_lockstat,
+[SYS_bcachectl] sys_bcachectl,
+[SYS_bcachestat] sys_bcachestat,
+[SYS_sync]    sys_sync,
+[SYS_fsync]   sys_fsync,
+[SYS_bcacheinval] sys_bcacheinval,
 };
 
 void
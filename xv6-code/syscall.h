@@ -20,3 +20,19 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_clock_gettime 22
+#define SYS_nanosleep 23
+#define SYS_clone  24
+#define SYS_join   25
+#define SYS_futex_wait 26
+#define SYS_futex_wake 27
+#define SYS_setaffinity 28
+#define SYS_getprocs 29
+#define SYS_setrt  30
+#define SYS_rtwait 31
+#define SYS_lockstat 32
+#define SYS_bcachectl 33
+#define SYS_bcachestat 34
+#define SYS_sync   35
+#define SYS_fsync  36
+#define SYS_bcacheinval 37
@@ -11,11 +11,18 @@
 #include "mmu.h"
 #include "proc.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "x86.h"
+#include "bcachestat.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// The descriptor table may be shared with other threads, which
+// could close fd meanwhile, so this takes a reference to the file;
+// the caller must drop it with fileclose when done.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
@@ -24,28 +31,28 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=proc->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE || (f=fileget(&proc->leader->ofile[fd])) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
-  if(pf)
-    *pf = f;
+  *pf = f;
   return 0;
 }
 
 // Allocate a file descriptor for the given file.
 // Takes over file reference from caller on success.
+// The table may be shared with other threads, so
+// claim the slot atomically.
 static int
 fdalloc(struct file *f)
 {
   int fd;
+  struct file **ofile;
 
-  for(fd = 0; fd < NOFILE; fd++){
-    if(proc->ofile[fd] == 0){
-      proc->ofile[fd] = f;
+  ofile = proc->leader->ofile;
+  for(fd = 0; fd < NOFILE; fd++)
+    if(cmpxchg((uint*)&ofile[fd], 0, (uint)f) == 0)
       return fd;
-    }
-  }
   return -1;
 }
 
@@ -55,11 +62,13 @@ sys_dup(void)
   struct file *f;
   int fd;
   
+  // The reference argfd takes becomes the new descriptor's.
   if(argfd(0, 0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
     return -1;
-  filedup(f);
+  }
   return fd;
 }
 
@@ -67,24 +76,32 @@ int
 sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  r = -1;
+  if(argint(2, &n) >= 0 && argptr(1, &p, n) >= 0)
+    r = fileread(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 int
 sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0)
     return -1;
-  return filewrite(f, p, n);
+  r = -1;
+  if(argint(2, &n) >= 0 && argptr(1, &p, n) >= 0)
+    r = filewrite(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 int
@@ -95,8 +112,13 @@ sys_close(void)
   
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  proc->ofile[fd] = 0;
-  fileclose(f);
+  // Another thread may be closing fd too.
+  if(cmpxchg((uint*)&proc->leader->ofile[fd], (uint)f, 0) != (uint)f){
+    fileclose(f);
+    return -1;
+  }
+  fileclose(f);  // the descriptor's reference
+  fileclose(f);  // argfd's
   return 0;
 }
 
@@ -105,10 +127,15 @@ sys_fstat(void)
 {
   struct file *f;
   struct stat *st;
+  int r;
   
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  r = -1;
+  if(argptr(1, (void*)&st, sizeof(*st)) >= 0)
+    r = filestat(f, st);
+  fileclose(f);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -369,8 +396,7 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(proc->cwd);
-  proc->cwd = ip;
+  iput((struct inode*)xchg((uint*)&proc->leader->cwd, (uint)ip));
   return 0;
 }
 
@@ -414,7 +440,7 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      proc->ofile[fd0] = 0;
+      proc->leader->ofile[fd0] = 0;
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -423,3 +449,57 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_bcachectl(void)
+{
+  int policy, nbuf;
+
+  if(argint(0, &policy) < 0 || argint(1, &nbuf) < 0)
+    return -1;
+  return bcachectl(policy, nbuf);
+}
+
+int
+sys_bcachestat(void)
+{
+  struct bcachestat *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  bcachestat(st);
+  return 0;
+}
+
+int
+sys_bcacheinval(void)
+{
+  return bcacheinval();
+}
+
+// Commit everything written so far to disk.
+int
+sys_sync(void)
+{
+  log_flush(1);
+  return 0;
+}
+
+// Commit the data written to a file.  The log holds
+// all files' data together, so this commits everything.
+int
+sys_fsync(void)
+{
+  struct file *f;
+  int r;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  r = -1;
+  if(f->type == FD_INODE){
+    log_flush(1);
+    r = 0;
+  }
+  fileclose(f);
+  return r;
+}
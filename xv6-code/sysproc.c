@@ -5,6 +5,9 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "time.h"
+#include "procstat.h"
+#include "lockstat.h"
 
 int
 sys_fork(void)
@@ -25,6 +28,107 @@ sys_wait(void)
   return wait();
 }
 
+int
+sys_clone(void)
+{
+  int fn, arg, stack;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg) < 0 || argint(2, &stack) < 0)
+    return -1;
+  return clone((void(*)(void*))fn, (void*)arg, (void*)stack);
+}
+
+int
+sys_join(void)
+{
+  void **ustack, *stack;
+  int pid;
+
+  if(argptr(0, (void*)&ustack, sizeof(*ustack)) < 0)
+    return -1;
+  if((pid = join(&stack)) >= 0)
+    *ustack = stack;
+  return pid;
+}
+
+int
+sys_futex_wait(void)
+{
+  int *addr, val;
+
+  if(argptr(0, (void*)&addr, sizeof(*addr)) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait((uint)addr, val);
+}
+
+int
+sys_futex_wake(void)
+{
+  int *addr, n;
+
+  if(argptr(0, (void*)&addr, sizeof(*addr)) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake((uint)addr, n);
+}
+
+int
+sys_setaffinity(void)
+{
+  int pid, mask;
+
+  if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return setaffinity(pid, mask);
+}
+
+int
+sys_getprocs(void)
+{
+  struct procstat *ps;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NPROC)
+    n = NPROC;
+  if(argptr(0, (void*)&ps, n*sizeof(*ps)) < 0)
+    return -1;
+  return getprocs(ps, n);
+}
+
+int
+sys_setrt(void)
+{
+  int runtime, period;
+
+  if(argint(0, &runtime) < 0 || argint(1, &period) < 0)
+    return -1;
+  if(runtime < 0 || period < 0)
+    return -1;
+  return setrt(runtime, period);
+}
+
+int
+sys_rtwait(void)
+{
+  return rtwait();
+}
+
+int
+sys_lockstat(void)
+{
+  struct lockstat *ls;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NLOCKNAME)
+    n = NLOCKNAME;
+  if(argptr(0, (void*)&ls, n*sizeof(*ls)) < 0)
+    return -1;
+  return lockstat(ls, n);
+}
+
 int
 sys_kill(void)
 {
@@ -59,32 +163,48 @@ int
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
   
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(proc->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  if(n <= 0)
+    return 0;
+  // Wake at a tick boundary, as when ticks were interrupts.
+  return sleepuntil((uint64)(tickcount() + n) * NSPERTICK);
 }
 
-// return how many clock tick interrupts have occurred
+// return how many clock ticks have elapsed
 // since start.
 int
 sys_uptime(void)
 {
-  uint xticks;
-  
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  return tickcount();
+}
+
+int
+sys_clock_gettime(void)
+{
+  int clk;
+  uint64 ns;
+  struct timespec *ts;
+
+  if(argint(0, &clk) < 0 || argptr(1, (void*)&ts, sizeof(*ts)) < 0)
+    return -1;
+  if(clk != CLOCK_MONOTONIC)
+    return -1;
+  ns = nsecs();
+  ts->tv_sec = divl(ns, NSPERSEC);
+  ts->tv_nsec = ns - (uint64)ts->tv_sec * NSPERSEC;
+  return 0;
+}
+
+int
+sys_nanosleep(void)
+{
+  struct timespec *ts;
+
+  if(argptr(0, (void*)&ts, sizeof(*ts)) < 0)
+    return -1;
+  if(ts->tv_sec < 0 || ts->tv_nsec < 0 || ts->tv_nsec >= NSPERSEC)
+    return -1;
+  return sleepuntil(nsecs() + (uint64)ts->tv_sec * NSPERSEC + ts->tv_nsec);
 }
@@ -0,0 +1,6 @@
+#define CLOCK_MONOTONIC 1  // time since boot
+
+struct timespec {
+  int tv_sec;   // seconds
+  int tv_nsec;  // nanoseconds, 0 to 999999999
+};
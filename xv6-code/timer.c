@@ -1,10 +1,17 @@
 // Intel 8253/8254/82C54 Programmable Interval Timer (PIT).
-// Only used on uniprocessors;
+// Only used for interrupts on uniprocessors;
 // SMP machines use the local APIC timer.
+// On all machines it is the reference used to
+// calibrate the TSC and the local APIC timer.
 
 #include "types.h"
 #include "defs.h"
+#include "param.h"
 #include "traps.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "timer.h"
 #include "x86.h"
 
 #define IO_TIMER1       0x040           // 8253 Timer #1
@@ -18,9 +25,16 @@
 
 #define TIMER_MODE      (IO_TIMER1 + 3) // timer mode port
 #define TIMER_SEL0      0x00    // select counter 0
+#define TIMER_SEL2      0x80    // select counter 2
+#define TIMER_ONESHOT   0x00    // mode 0, interrupt on terminal count
 #define TIMER_RATEGEN   0x04    // mode 2, rate generator
 #define TIMER_16BIT     0x30    // r/w counter 16 bits, LSB first
 
+#define IO_PPI          0x61    // counter 2 gate and output
+#define PPI_GATE2       0x01    // enable counter 2
+#define PPI_SPEAKER     0x02    // connect counter 2 to speaker
+#define PPI_OUT2        0x20    // counter 2 output
+
 void
 timerinit(void)
 {
@@ -30,3 +44,352 @@ timerinit(void)
   outb(IO_TIMER1, TIMER_DIV(100) / 256);
   picenable(IRQ_TIMER);
 }
+
+// Busy-wait for ms milliseconds (at most 54) using PIT
+// counter 2, which is not wired to any interrupt.
+void
+pitwait(int ms)
+{
+  uint count;
+
+  count = TIMER_FREQ * ms / 1000;
+  outb(IO_PPI, (inb(IO_PPI) & ~PPI_SPEAKER) | PPI_GATE2);
+  outb(TIMER_MODE, TIMER_SEL2 | TIMER_ONESHOT | TIMER_16BIT);
+  outb(IO_TIMER1+2, count % 256);
+  outb(IO_TIMER1+2, count / 256);
+  while((inb(IO_PPI) & PPI_OUT2) == 0)
+    ;
+}
+
+//PAGEBREAK!
+// Clock and tickless timekeeping.
+//
+// nsecs() is a monotonic nanosecond clock read from the
+// TSC, whose rate clockinit() measures against the PIT.
+// Clock ticks are HZ fixed intervals of that clock.
+//
+// With a local APIC, each CPU's timer runs in one-shot
+// mode, calibrated against the PIT as well, and is armed
+// only for the nearest deadline that CPU cares about: the
+// end of the running process's time slice, if another
+// process is waiting for the CPU, and the next event in the
+// timer wheel below, if this CPU is the one that owns it.
+// Idle CPUs and CPUs running a single task take no timer
+// interrupts at all, and sleeps are not rounded to ticks.
+//
+// Without a local APIC, the PIT interrupts HZ times a
+// second and the timer wheel is run on every interrupt.
+
+#define NSSHIFT 22
+
+static uint64 tsc0;       // TSC value at time 0
+static uint nsmult;       // ns per TSC cycle, times 2^NSSHIFT
+static uint64 wakeat;     // Time of next wheel event, or 0
+static struct cpu *wakecpu;  // CPU whose timer is armed for wakeat
+
+static uint64 wheelnext(void);
+static void wheelrun(uint64);
+
+void
+clockinit(void)
+{
+  uint tsckhz;
+
+  tsc0 = rdtsc();
+  pitwait(CALMS);
+  tsckhz = (uint)(rdtsc() - tsc0) / CALMS;
+  nsmult = divl((uint64)1000000 << NSSHIFT, tsckhz);
+  if(lapic)
+    lapiccalibrate();
+  cprintf("clock: tsc %d kHz\n", tsckhz);
+}
+
+// Return nanoseconds since boot.
+uint64
+nsecs(void)
+{
+  uint64 d;
+
+  // Multiply the two halves separately so that
+  // the product cannot overflow.
+  d = rdtsc() - tsc0;
+  return (((uint64)(uint)(d >> 32) * nsmult) << (32 - NSSHIFT)) +
+         (((uint64)(uint)d * nsmult) >> NSSHIFT);
+}
+
+// Return the number of clock ticks since boot.
+uint
+tickcount(void)
+{
+  return divl(nsecs(), NSPERTICK);
+}
+
+// Program this CPU's timer for its nearest deadline.
+// Must be called with interrupts off.  wakeat and
+// wakecpu are read without tickslock: a stale value
+// at worst arms one unneeded interrupt, since whoever
+// changed them has armed its own timer already.
+void
+timerarm(void)
+{
+  uint64 dl, now;
+
+  if(!lapic)
+    return;
+  dl = cpu->slice;
+  if(wakecpu == cpu && wakeat && (dl == 0 || wakeat < dl))
+    dl = wakeat;
+  if(dl == 0){
+    lapictimer(0);
+    return;
+  }
+  now = nsecs();
+  lapictimer(dl > now ? dl - now : 1);
+}
+
+// Start a time slice of len ns for the process running on
+// this CPU, or if len is 0, let it run until it gives up the
+// CPU by itself.  Must be called with interrupts off.
+void
+timerslice(uint64 len)
+{
+  if(!lapic)
+    return;
+  cpu->slice = len ? nsecs() + len : 0;
+  timerarm();
+}
+
+// Should the process running on this CPU be preempted?
+int
+sliceover(void)
+{
+  if(!lapic)
+    return 1;
+  return cpu->slice && nsecs() >= cpu->slice;
+}
+
+// Timer interrupt.  Any CPU whose interrupt finds the
+// next wheel event due runs the wheel and takes over
+// the job of arming the timer for the event after it.
+void
+clockintr(void)
+{
+  uint64 next;
+
+  acquire(&tickslock);
+  if(!lapic){
+    ticks++;
+    wheelrun(nsecs());
+    release(&tickslock);
+    return;
+  }
+  ticks = tickcount();
+  if(wakeat && nsecs() >= wakeat){
+    wheelrun(nsecs());
+    next = wheelnext();
+    wakeat = next;
+    wakecpu = next ? cpu : 0;
+  }
+  release(&tickslock);
+  timerarm();
+}
+
+//PAGEBREAK!
+// Hierarchical timer wheel.
+//
+// Time is divided into units of 2^WSHIFT ns (about 16us).
+// Level l of the wheel has WSIZE slots, each covering
+// WSIZE^l units; a timer due u units from now is kept at
+// the lowest level whose span covers u, in the slot for
+// its due unit.  When the wheel reaches the start of a
+// higher-level slot, the timers in it are cascaded down
+// to finer levels, and the timers in the level-0 slot of
+// the current unit are run.  Adding and deleting a timer
+// are O(1), and each timer runs exactly once.
+//
+// wclock is the first unit not yet processed.  The wheel
+// does not step through idle units one by one: wheelfirst()
+// finds the next unit with work in it, and wheelrun()
+// jumps straight there.
+//
+// tickslock protects the wheel.
+
+#define WSHIFT  14
+#define WBITS   6
+#define WSIZE   (1<<WBITS)
+#define WMASK   (WSIZE-1)
+#define WLEVELS 6
+
+static struct timer *wheel[WLEVELS][WSIZE];
+static uint64 wclock;
+
+// Put t in its slot.  Returns the unit at which the wheel
+// will next have to look at t.
+static uint64
+wheelinsert(struct timer *t)
+{
+  uint64 u, delta;
+  int l;
+  struct timer **slot;
+
+  u = (t->expires + (1<<WSHIFT) - 1) >> WSHIFT;
+  if(u < wclock)
+    u = wclock;
+  delta = u - wclock;
+  for(l = 0; l < WLEVELS-1; l++)
+    if(delta < (1ULL << (WBITS*(l+1))))
+      break;
+  if(delta >= (1ULL << (WBITS*(l+1))))
+    u = wclock + (1ULL << (WBITS*(l+1))) - 1;  // far future: cascade again later
+
+  slot = &wheel[l][(u >> (WBITS*l)) & WMASK];
+  t->next = *slot;
+  if(t->next)
+    t->next->pprev = &t->next;
+  t->pprev = slot;
+  *slot = t;
+  return (u >> (WBITS*l)) << (WBITS*l);
+}
+
+static void
+wheelunlink(struct timer *t)
+{
+  *t->pprev = t->next;
+  if(t->next)
+    t->next->pprev = t->pprev;
+  t->pprev = 0;
+}
+
+// Return the first unit from wclock on that has a timer
+// to run or a slot to cascade, or ~0 if the wheel is empty.
+// At levels above 0 the current slot holds timers for the
+// next time around, unless wclock is exactly at its start.
+static uint64
+wheelfirst(void)
+{
+  uint64 base, t, best;
+  int l, i, j, j0;
+
+  best = ~0ULL;
+  for(l = 0; l < WLEVELS; l++){
+    base = wclock >> (WBITS*l);
+    i = base & WMASK;
+    j0 = (l == 0 || (wclock & ((1ULL << (WBITS*l)) - 1)) == 0) ? 0 : 1;
+    for(j = j0; j < j0+WSIZE; j++){
+      if(wheel[l][(i+j) & WMASK]){
+        t = (base + j) << (WBITS*l);
+        if(t < best)
+          best = t;
+        break;
+      }
+    }
+  }
+  return best;
+}
+
+// Return the nsecs() time of the next wheel event, or 0.
+static uint64
+wheelnext(void)
+{
+  uint64 u;
+
+  u = wheelfirst();
+  if(u == ~0ULL)
+    return 0;
+  return u ? u << WSHIFT : 1;
+}
+
+// Run the timers that have expired by time now.
+static void
+wheelrun(uint64 now)
+{
+  uint64 to, u;
+  int l;
+  struct timer *list, *t;
+
+  to = now >> WSHIFT;
+  while((u = wheelfirst()) <= to){
+    wclock = u;
+    for(l = WLEVELS-1; l > 0; l--){
+      if(wclock & ((1ULL << (WBITS*l)) - 1))
+        continue;
+      list = wheel[l][(wclock >> (WBITS*l)) & WMASK];
+      wheel[l][(wclock >> (WBITS*l)) & WMASK] = 0;
+      while((t = list) != 0){
+        list = t->next;
+        wheelinsert(t);
+      }
+    }
+
+    // Detach the slot first, so that a timer function
+    // re-adding a timer cannot make this loop run forever.
+    list = wheel[0][wclock & WMASK];
+    wheel[0][wclock & WMASK] = 0;
+    if(list)
+      list->pprev = &list;
+    while((t = list) != 0){
+      wheelunlink(t);
+      t->fn(t->arg);
+    }
+    wclock++;
+  }
+  if(wclock <= to)
+    wclock = to + 1;
+}
+
+// Arrange for fn(arg) to be called from the clock interrupt
+// once nsecs() reaches expires.  Caller must hold tickslock;
+// fn is called with it held.
+void
+timeradd(struct timer *t, uint64 expires, void (*fn)(void*), void *arg)
+{
+  uint64 at;
+
+  if(t->pprev)
+    panic("timeradd");
+  t->expires = expires;
+  t->fn = fn;
+  t->arg = arg;
+  at = wheelinsert(t) << WSHIFT;
+  if(at == 0)
+    at = 1;
+  if(lapic && (wakeat == 0 || at < wakeat)){
+    wakeat = at;
+    wakecpu = cpu;
+    timerarm();
+  }
+}
+
+// Cancel t if it has not run yet.  Caller must hold tickslock.
+void
+timerdel(struct timer *t)
+{
+  if(t->pprev)
+    wheelunlink(t);
+}
+
+// Sleep until nsecs() reaches dl.
+// Return -1 if killed in the meantime.
+int
+sleepuntil(uint64 dl)
+{
+  struct timer t;
+  int r;
+
+  if(nsecs() >= dl)
+    return 0;
+  r = 0;
+  t.pprev = 0;
+  acquire(&tickslock);
+  timeradd(&t, dl, wakeup, &t);
+  while(t.pprev){
+    if(proc->killed){
+      r = -1;
+      break;
+    }
+    sleep(&t, &tickslock);
+  }
+  timerdel(&t);
+  release(&tickslock);
+  return r;
+}
@@ -0,0 +1,9 @@
+// Kernel timer: once nsecs() reaches expires, the clock
+// interrupt calls fn(arg) with tickslock held.  See timer.c.
+struct timer {
+  uint64 expires;          // Deadline, in nsecs() time
+  void (*fn)(void*);
+  void *arg;
+  struct timer *next;      // Wheel slot list
+  struct timer **pprev;    // Link pointing at this timer; 0 if not pending
+};
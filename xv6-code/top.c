@@ -0,0 +1,122 @@
+// Show the processes using the most CPU time,
+// refreshing every few seconds.
+// usage: top [secs [count]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "procstat.h"
+
+#define NSTAT 256   // processes fetched per refresh
+#define NSHOW 16    // processes listed per refresh
+
+struct procstat cur[NSTAT], prev[NSTAT];
+int order[NSTAT];
+uint busy[NSTAT];
+
+char *states[] = { "unused", "embryo", "sleep", "runble", "run", "zombie" };
+
+// Print s left-justified in a field w wide.
+void
+putstr(char *s, int w)
+{
+  int n;
+
+  n = strlen(s);
+  printf(1, "%s", s);
+  while(n++ < w)
+    printf(1, " ");
+}
+
+// Print n right-justified in a field w wide.
+void
+putnum(int n, int w)
+{
+  char buf[12];
+  int i;
+
+  i = sizeof(buf) - 1;
+  buf[i] = 0;
+  do {
+    buf[--i] = '0' + n % 10;
+    n /= 10;
+  } while(n > 0 && i > 0);
+  while(w-- > sizeof(buf) - 1 - i)
+    printf(1, " ");
+  printf(1, "%s ", buf + i);
+}
+
+// Return the entry for pid in the previous refresh, or 0.
+struct procstat*
+lookup(int pid, int nprev)
+{
+  int i;
+
+  for(i = 0; i < nprev; i++)
+    if(prev[i].pid == pid)
+      return &prev[i];
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int secs, count, n, nprev, i, j, k;
+  uint now, then, dt;
+  struct procstat *p, *o;
+
+  secs = argc > 1 ? atoi(argv[1]) : 2;
+  count = argc > 2 ? atoi(argv[2]) : -1;
+  if(secs <= 0){
+    printf(2, "usage: top [secs [count]]\n");
+    exit();
+  }
+
+  nprev = 0;
+  then = 0;
+  for(; count != 0; count--){
+    n = getprocs(cur, NSTAT);
+    now = uptime();
+    dt = now > then ? now - then : 1;
+
+    // CPU ticks used since the last refresh, and
+    // the order to list processes in, busiest first.
+    for(i = 0; i < n; i++){
+      p = &cur[i];
+      busy[i] = p->uticks + p->kticks;
+      if((o = lookup(p->pid, nprev)) != 0)
+        busy[i] -= o->uticks + o->kticks;
+      for(j = i; j > 0 && busy[order[j-1]] < busy[i]; j--)
+        order[j] = order[j-1];
+      order[j] = i;
+    }
+
+    printf(1, "\n%d processes, uptime %d ticks\n", n, now);
+    printf(1, "  PID  PPID STATE  CPU %%CPU   USER    SYS   WAIT   VCSW  IVCSW   MIG MISS NAME\n");
+    for(k = 0; k < n && k < NSHOW; k++){
+      i = order[k];
+      p = &cur[i];
+      putnum(p->pid, 5);
+      putnum(p->ppid, 5);
+      putstr(p->state >= 0 && p->state < 6 ? states[p->state] : "?", 7);
+      putnum(p->cpu < 0 ? 0 : p->cpu, 3);
+      putnum(busy[i] * 100 / dt, 4);
+      putnum(p->uticks, 6);
+      putnum(p->kticks, 6);
+      putnum(p->waitticks, 6);
+      putnum(p->nvcsw, 6);
+      putnum(p->nivcsw, 6);
+      putnum(p->migrations, 5);
+      putnum(p->rtmissed, 4);
+      printf(1, "%s\n", p->name);
+    }
+
+    memmove(prev, cur, n * sizeof(cur[0]));
+    nprev = n;
+    then = now;
+    if(count != 1)
+      sleep(secs * HZ);
+  }
+  exit();
+}
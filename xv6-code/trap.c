@@ -36,6 +36,9 @@ idtinit(void)
 void
 trap(struct trapframe *tf)
 {
+  if(proc && (tf->cs&3) == DPL_USER)
+    acctenter();
+
   if(tf->trapno == T_SYSCALL){
     if(proc->killed)
       exit();
@@ -43,17 +46,15 @@ trap(struct trapframe *tf)
     syscall();
     if(proc->killed)
       exit();
+    if(cpu->preempt)
+      resched();
+    acctleave();
     return;
   }
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
-    if(cpu->id == 0){
-      acquire(&tickslock);
-      ticks++;
-      wakeup(&ticks);
-      release(&tickslock);
-    }
+    clockintr();
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -63,6 +64,11 @@ trap(struct trapframe *tf)
   case T_IRQ0 + IRQ_IDE+1:
     // Bochs generates spurious IDE1 interrupts.
     break;
+  case T_IRQ0 + IRQ_RESCHED:
+    // An idle CPU only had to be woken from hlt so that
+    // scheduler() looks again; a busy one checks below.
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_KBD:
     kbdintr();
     lapiceoi();
@@ -100,12 +106,19 @@ trap(struct trapframe *tf)
   if(proc && proc->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU when its time slice ends.
   // If interrupts were on while locks held, would need to check nlock.
-  if(proc && proc->state == RUNNING && tf->trapno == T_IRQ0+IRQ_TIMER)
+  if(proc && proc->state == RUNNING && tf->trapno == T_IRQ0+IRQ_TIMER &&
+     sliceover())
     yield();
+  if(proc && proc->state == RUNNING &&
+     (tf->trapno == T_IRQ0+IRQ_RESCHED || cpu->preempt))
+    resched();
 
   // Check if the process has been killed since we yielded
   if(proc && proc->killed && (tf->cs&3) == DPL_USER)
     exit();
+
+  if(proc && (tf->cs&3) == DPL_USER)
+    acctleave();
 }
@@ -103,3 +103,84 @@ memmove(void *vdst, void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+//PAGEBREAK!
+// Threads.  thread_create runs fn(arg) in a new thread
+// on a malloc'd stack; when fn returns the thread exits.
+// thread_join waits for some thread to finish, frees its
+// stack and returns its pid.  The threads share memory,
+// so malloc and free must not be called in two of them
+// at once.
+
+#define TSTACK 4096  // size of a clone() stack: one page
+
+struct tstart {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static void
+threadstart(void *a)
+{
+  struct tstart *t;
+
+  t = a;
+  t->fn(t->arg);
+  exit();
+}
+
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  struct tstart *t;
+  int pid;
+
+  // The stack grows down from the top of the block,
+  // so the bottom can hold fn and arg.
+  if((t = malloc(TSTACK)) == 0)
+    return -1;
+  t->fn = fn;
+  t->arg = arg;
+  if((pid = clone(threadstart, t, t)) < 0)
+    free(t);
+  return pid;
+}
+
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) >= 0)
+    free(stack);
+  return pid;
+}
+
+// Mutexes.  Locking and unlocking an uncontended mutex
+// make no system calls; a thread that has to wait marks
+// the mutex as having waiters (state 2) and sleeps in
+// futex_wait, and unlocking a mutex with waiters wakes
+// one of them with futex_wake.
+
+void
+mutex_lock(struct mutex *m)
+{
+  uint c;
+
+  if((c = cmpxchg(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = xchg(&m->state, 2);
+  while(c != 0){
+    futex_wait((int*)&m->state, 2);
+    c = xchg(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(xchg(&m->state, 0) == 2)
+    futex_wake((int*)&m->state, 1);
+}
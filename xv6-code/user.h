@@ -1,4 +1,13 @@
 struct stat;
+struct timespec;
+struct procstat;
+struct lockstat;
+struct bcachestat;
+
+// A lock for threads; zero-initialized means unlocked.
+struct mutex {
+  volatile uint state;  // 0 unlocked, 1 locked, 2 locked with waiters
+};
 
 // system calls
 int fork(void);
@@ -22,6 +31,22 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int clock_gettime(int, struct timespec*);
+int nanosleep(struct timespec*);
+int clone(void(*)(void*), void*, void*);
+int join(void**);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+int setaffinity(int, int);
+int getprocs(struct procstat*, int);
+int setrt(int, int);
+int rtwait(void);
+int lockstat(struct lockstat*, int);
+int bcachectl(int, int);
+int bcachestat(struct bcachestat*);
+int sync(void);
+int fsync(int);
+int bcacheinval(void);
 
 // ulib.c
 int stat(char*, struct stat*);
@@ -36,3 +61,12 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+int thread_create(void(*)(void*), void*);
+int thread_join(void);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+
+// bench.c
+uint64 usecs(void);
+int ncpus(void);
+uint benchrun(int, int, int(*)(void), uint*);
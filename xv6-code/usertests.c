@@ -7,6 +7,10 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "time.h"
+#include "procstat.h"
+#include "lockstat.h"
+#include "bcachestat.h"
 
 char buf[8192];
 char name[3];
@@ -324,6 +328,660 @@ exitwait(void)
   printf(1, "exitwait ok\n");
 }
 
+// clock_gettime is monotonic, and nanosleep sleeps at
+// least as long as asked for.
+void
+nanosleeptest(void)
+{
+  struct timespec t0, t1, req;
+  int i, us;
+
+  printf(1, "nanosleep test\n");
+  if(clock_gettime(CLOCK_MONOTONIC, &t0) < 0){
+    printf(1, "clock_gettime failed\n");
+    exit();
+  }
+  for(i = 0; i < 1000; i++){
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if(t1.tv_sec < t0.tv_sec ||
+       (t1.tv_sec == t0.tv_sec && t1.tv_nsec < t0.tv_nsec)){
+      printf(1, "clock went backwards\n");
+      exit();
+    }
+    t0 = t1;
+  }
+
+  req.tv_sec = 0;
+  req.tv_nsec = 2500000;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if(nanosleep(&req) < 0){
+    printf(1, "nanosleep failed\n");
+    exit();
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  us = (t1.tv_sec - t0.tv_sec)*1000000 + (t1.tv_nsec - t0.tv_nsec)/1000;
+  if(us < 2500){
+    printf(1, "nanosleep woke after %d us\n", us);
+    exit();
+  }
+
+  req.tv_nsec = NSPERSEC;
+  if(nanosleep(&req) >= 0){
+    printf(1, "nanosleep accepted bad tv_nsec\n");
+    exit();
+  }
+  printf(1, "nanosleep test ok (2500 us took %d us)\n", us);
+}
+
+// concurrent sleepers with deadlines at different
+// levels of the kernel's timer wheel each wake once,
+// no earlier than asked; a killed sleeper wakes at once.
+void
+sleepwheeltest(void)
+{
+  static int ns[] = { 100000, 2000000, 50000000, 700000000 };
+  struct timespec t0, t1, req;
+  int i, pid, us, fds[2];
+  char c;
+
+  printf(1, "sleep wheel test\n");
+  // A sleeper that wakes early writes to the pipe.
+  if(pipe(fds) < 0){
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(ns)/sizeof(ns[0]); i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      close(fds[0]);
+      req.tv_sec = 0;
+      req.tv_nsec = ns[i];
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      nanosleep(&req);
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      us = (t1.tv_sec - t0.tv_sec)*1000000 + (t1.tv_nsec - t0.tv_nsec)/1000;
+      if(us < ns[i]/1000){
+        printf(1, "sleeper woke after %d us, wanted %d\n", us, ns[i]/1000);
+        write(fds[1], "x", 1);
+      }
+      exit();
+    }
+  }
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 0){
+    printf(1, "sleep wheel test: woke early\n");
+    exit();
+  }
+  close(fds[0]);
+  for(i = 0; i < sizeof(ns)/sizeof(ns[0]); i++)
+    wait();
+
+  pid = fork();
+  if(pid == 0){
+    sleep(100*100);
+    printf(1, "killed sleeper ran on\n");
+    exit();
+  }
+  sleep(1);
+  kill(pid);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  wait();
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if(t1.tv_sec - t0.tv_sec > 1){
+    printf(1, "killed sleeper took too long\n");
+    exit();
+  }
+  printf(1, "sleep wheel test ok\n");
+}
+
+// threads share memory and file descriptors, and
+// exiting the main thread takes the others with it.
+int tsum[4];
+char *tmem;
+int tfd;
+
+void
+threadsum(void *arg)
+{
+  int i, n;
+
+  n = (int)arg;
+  for(i = n*1000; i < (n+1)*1000; i++)
+    tsum[n] += i;
+}
+
+void
+threadshare(void *arg)
+{
+  tmem = sbrk(4096);
+  tmem[0] = 'x';
+  tfd = open("threadfile", O_CREATE|O_RDWR);
+}
+
+void
+threadspin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+volatile int tstop;
+
+void
+threadwait(void *arg)
+{
+  while(!tstop)
+    ;
+}
+
+void
+threadtest(void)
+{
+  int i, n, pid;
+
+  printf(1, "thread test\n");
+  for(i = 0; i < 4; i++){
+    if(thread_create(threadsum, (void*)i) < 0){
+      printf(1, "thread_create failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < 4; i++){
+    if(thread_join() < 0){
+      printf(1, "thread_join failed\n");
+      exit();
+    }
+  }
+  if(thread_join() != -1){
+    printf(1, "thread_join with no threads\n");
+    exit();
+  }
+  n = 0;
+  for(i = 0; i < 4; i++)
+    n += tsum[i];
+  if(n != 3999*4000/2){
+    printf(1, "thread sum %d wrong\n", n);
+    exit();
+  }
+
+  tfd = -1;
+  thread_create(threadshare, 0);
+  thread_join();
+  if(tmem == 0 || tmem[0] != 'x' || tfd < 0 || write(tfd, "a", 1) != 1){
+    printf(1, "threads do not share memory and files\n");
+    exit();
+  }
+  close(tfd);
+  unlink("threadfile");
+
+  // Other threads could still use pages sbrk would free.
+  tstop = 0;
+  thread_create(threadwait, 0);
+  if(sbrk(-4096) != (char*)-1){
+    printf(1, "sbrk shrank a threaded process\n");
+    exit();
+  }
+  tstop = 1;
+  thread_join();
+
+  pid = fork();
+  if(pid == 0){
+    thread_create(threadspin, 0);
+    thread_create(threadspin, 0);
+    sleep(1);
+    exit();
+  }
+  if(wait() != pid){
+    printf(1, "wait for threaded child failed\n");
+    exit();
+  }
+  printf(1, "thread test ok\n");
+}
+
+// a mutex keeps contending threads from losing updates.
+struct mutex tmutex;
+int tcount;
+
+void
+threadcount(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 20000; i++){
+    mutex_lock(&tmutex);
+    tcount++;
+    mutex_unlock(&tmutex);
+  }
+}
+
+void
+mutextest(void)
+{
+  int i, word;
+
+  printf(1, "mutex test\n");
+  word = 1;
+  if(futex_wait(&word, 0) != -1){
+    printf(1, "futex_wait slept on a changed word\n");
+    exit();
+  }
+  if(futex_wake(&word, 1) != 0){
+    printf(1, "futex_wake woke a waiter that does not exist\n");
+    exit();
+  }
+  for(i = 0; i < 4; i++)
+    thread_create(threadcount, 0);
+  for(i = 0; i < 4; i++)
+    thread_join();
+  if(tcount != 4*20000){
+    printf(1, "mutex count %d, want %d\n", tcount, 4*20000);
+    exit();
+  }
+  printf(1, "mutex test ok\n");
+}
+
+// setaffinity pins a process to a set of CPUs.
+void
+affinitytest(void)
+{
+  int all, pid, i, fds[2];
+  char c;
+
+  printf(1, "affinity test\n");
+  if(setaffinity(0, 0) != -1){
+    printf(1, "setaffinity accepted an empty mask\n");
+    exit();
+  }
+  if((all = setaffinity(0, 1)) < 1 || (all & 1) == 0){
+    printf(1, "setaffinity returned mask %x\n", all);
+    exit();
+  }
+  // The child reports a failure by writing to the pipe.
+  if(pipe(fds) < 0){
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[0]);
+    // Inherited mask.
+    if(setaffinity(0, all) != 1){
+      printf(1, "fork did not inherit affinity\n");
+      write(fds[1], "x", 1);
+    }
+    for(i = 0; i < 1000000; i++)
+      ;
+    exit();
+  }
+  close(fds[1]);
+  if(setaffinity(pid, 1) < 0 || setaffinity(-1, 1) != -1){
+    printf(1, "setaffinity by pid failed\n");
+    exit();
+  }
+  if(read(fds[0], &c, 1) != 0){
+    printf(1, "affinity test failed\n");
+    exit();
+  }
+  close(fds[0]);
+  wait();
+  setaffinity(0, all);
+  printf(1, "affinity test ok\n");
+}
+
+// getprocs reports this process's CPU time and switches.
+struct procstat pstats[64];
+
+struct procstat*
+mystat(void)
+{
+  int i, n;
+
+  n = getprocs(pstats, 64);
+  for(i = 0; i < n; i++)
+    if(pstats[i].pid == getpid())
+      return &pstats[i];
+  return 0;
+}
+
+void
+procstattest(void)
+{
+  struct procstat *ps;
+  uint nvcsw;
+  int t;
+
+  printf(1, "procstat test\n");
+  if((ps = mystat()) == 0){
+    printf(1, "getprocs did not report this process\n");
+    exit();
+  }
+  nvcsw = ps->nvcsw;
+  sleep(1);
+  t = uptime();
+  while(uptime() < t + 5)
+    ;
+  if((ps = mystat()) == 0 || ps->nvcsw <= nvcsw || ps->uticks + ps->kticks < 3){
+    printf(1, "procstat counters wrong\n");
+    exit();
+  }
+  printf(1, "procstat test ok\n");
+}
+
+// setrt admits only reservations that fit, rtwait runs
+// periodic jobs, and a job that overruns its budget
+// is counted as missing its deadline.
+void
+edftest(void)
+{
+  struct procstat *ps;
+  int pid, i, t, fds[2];
+  char *err, c;
+
+  printf(1, "edf test\n");
+  if(setrt(2000, 1000) != -1 || setrt(2000, 10000000) != -1 ||
+     setrt(950000, 1000000) != -1){
+    printf(1, "setrt accepted a bad reservation\n");
+    exit();
+  }
+  if(rtwait() != -1){
+    printf(1, "rtwait without a reservation\n");
+    exit();
+  }
+  // The child reports a failure by writing to the pipe.
+  if(pipe(fds) < 0){
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[0]);
+    err = 0;
+    if(setrt(2000, 10000) < 0)
+      err = "setrt failed";
+    for(i = 0; err == 0 && i < 20; i++)
+      if(rtwait() < 0)
+        err = "rtwait failed";
+    if(err == 0){
+      t = uptime();
+      while(uptime() < t + 3)
+        ;
+      ps = mystat();
+      if(ps == 0 || ps->rtperiod != 10000 || ps->rtmissed == 0)
+        err = "missed deadlines not counted";
+    }
+    setrt(0, 0);
+    if(err){
+      printf(1, "%s\n", err);
+      write(fds[1], "x", 1);
+    }
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 0){
+    printf(1, "edf test failed\n");
+    exit();
+  }
+  close(fds[0]);
+  wait();
+  printf(1, "edf test ok\n");
+}
+
+// lockstat counts acquisitions of ptable.lock.
+struct lockstat lstats[NLOCKNAME];
+
+void
+lockstattest(void)
+{
+  int i, n;
+
+  printf(1, "lockstat test\n");
+  n = lockstat(lstats, NLOCKNAME);
+  for(i = 0; i < n; i++)
+    if(strcmp(lstats[i].name, "ptable") == 0)
+      break;
+  if(i == n || lstats[i].acquires == 0 || lstats[i].contended > lstats[i].acquires){
+    printf(1, "lockstat did not count ptable\n");
+    exit();
+  }
+  printf(1, "lockstat test ok\n");
+}
+
+// Processes reading the same file contend for the buffer
+// mutexes; check that their statistics add up.
+void
+kmutextest(void)
+{
+  int i, j, n, fd;
+  char buf[512];
+
+  printf(1, "kmutex test\n");
+  for(i = 0; i < 4; i++){
+    if(fork() == 0){
+      for(j = 0; j < 20; j++){
+        if((fd = open("README", 0)) < 0){
+          printf(1, "kmutex test: open README failed\n");
+          exit();
+        }
+        while(read(fd, buf, sizeof(buf)) > 0)
+          ;
+        close(fd);
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < 4; i++)
+    wait();
+
+  n = lockstat(lstats, NLOCKNAME);
+  for(i = 0; i < n; i++)
+    if(strcmp(lstats[i].name, "buffer") == 0)
+      break;
+  if(i == n || lstats[i].acquires == 0 ||
+     lstats[i].sleeps > lstats[i].contended ||
+     lstats[i].handoffs > lstats[i].acquires){
+    printf(1, "kmutex test: bad buffer statistics\n");
+    exit();
+  }
+  printf(1, "kmutex test ok\n");
+}
+
+// Reading a file twice should hit in the buffer cache
+// the second time.
+void
+bcachetest(void)
+{
+  struct bcachestat s0, s1;
+  int fd;
+  char buf[512];
+
+  printf(1, "bcache test\n");
+  if(bcachectl(BC_LRU+1, -1) != -1){
+    printf(1, "bcachectl accepted a bad policy\n");
+    exit();
+  }
+  if(bcachectl(-1, 1) != -1){
+    printf(1, "bcachectl accepted a limit below NBUF\n");
+    exit();
+  }
+  if((fd = open("README", 0)) < 0){
+    printf(1, "bcache test: open README failed\n");
+    exit();
+  }
+  read(fd, buf, sizeof(buf));
+  close(fd);
+  bcachestat(&s0);
+  fd = open("README", 0);
+  read(fd, buf, sizeof(buf));
+  close(fd);
+  bcachestat(&s1);
+  if(s1.hits == s0.hits || s1.nbuf < s1.na1){
+    printf(1, "bcache test: no hits\n");
+    exit();
+  }
+  if(s1.type[BT_DATA].hits == s0.type[BT_DATA].hits ||
+     s1.type[BT_INODE].hits + s1.type[BT_INODE].misses == 0 ||
+     s1.type[BT_LOG].writes == 0){
+    printf(1, "bcache test: bad per-type counts\n");
+    exit();
+  }
+
+  // After invalidating, the blocks must be read again.
+  if(bcacheinval() <= 0){
+    printf(1, "bcache test: nothing invalidated\n");
+    exit();
+  }
+  fd = open("README", 0);
+  read(fd, buf, sizeof(buf));
+  close(fd);
+  bcachestat(&s0);
+  if(s0.type[BT_DATA].misses == s1.type[BT_DATA].misses){
+    printf(1, "bcache test: README still cached\n");
+    exit();
+  }
+  printf(1, "bcache test ok\n");
+}
+
+// A sequential read of a file that is not cached
+// should read ahead, and read the right data.
+void
+readaheadtest(void)
+{
+  struct bcachestat s0, s1;
+  int fd, i, j, n;
+  char buf[512];
+
+  printf(1, "readahead test\n");
+  if((fd = open("ra", O_CREATE|O_RDWR)) < 0){
+    printf(1, "readahead test: create failed\n");
+    exit();
+  }
+  n = 30 * BSIZE / sizeof(buf);
+  for(i = 0; i < n; i++){
+    memset(buf, i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "readahead test: write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  // Empty the cache.
+  bcachestat(&s0);
+  sync();
+  bcacheinval();
+
+  fd = open("ra", 0);
+  for(i = 0; i < n; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "readahead test: read failed\n");
+      exit();
+    }
+    for(j = 0; j < sizeof(buf); j++){
+      if(buf[j] != (char)i){
+        printf(1, "readahead test: wrong data\n");
+        exit();
+      }
+    }
+  }
+  close(fd);
+  unlink("ra");
+  bcachestat(&s1);
+  if(s1.aheads == s0.aheads){
+    printf(1, "readahead test: no readahead\n");
+    exit();
+  }
+  printf(1, "readahead test ok\n");
+}
+
+// sync and fsync commit what was written; the data
+// reads back the same either way.
+void
+synctest(void)
+{
+  int fd, p[2];
+  char buf[16];
+
+  printf(1, "sync test\n");
+  if((fd = open("synced", O_CREATE|O_RDWR)) < 0){
+    printf(1, "sync test: create failed\n");
+    exit();
+  }
+  if(write(fd, "hello", 5) != 5 || fsync(fd) != 0){
+    printf(1, "sync test: fsync failed\n");
+    exit();
+  }
+  close(fd);
+  if(sync() != 0){
+    printf(1, "sync test: sync failed\n");
+    exit();
+  }
+  if(pipe(p) < 0 || fsync(p[0]) != -1 || fsync(-1) != -1){
+    printf(1, "sync test: fsync of a pipe succeeded\n");
+    exit();
+  }
+  close(p[0]);
+  close(p[1]);
+  fd = open("synced", 0);
+  memset(buf, 0, sizeof(buf));
+  if(read(fd, buf, sizeof(buf)-1) != 5 || strcmp(buf, "hello") != 0){
+    printf(1, "sync test: wrong data\n");
+    exit();
+  }
+  close(fd);
+  unlink("synced");
+  printf(1, "sync test ok\n");
+}
+
+// Overwriting whole blocks, which skips reading them,
+// and parts of blocks keep the rest of the file intact,
+// with the old contents out of the cache.
+void
+overwritetest(void)
+{
+  int fd, i;
+
+  printf(1, "overwrite test\n");
+  if((fd = open("ow", O_CREATE|O_RDWR)) < 0){
+    printf(1, "overwrite test: create failed\n");
+    exit();
+  }
+  memset(buf, 'a', 2*BSIZE);
+  if(write(fd, buf, 2*BSIZE) != 2*BSIZE){
+    printf(1, "overwrite test: write failed\n");
+    exit();
+  }
+  close(fd);
+  sync();
+  bcacheinval();
+
+  fd = open("ow", O_RDWR);
+  memset(buf, 'b', BSIZE);
+  if(write(fd, buf, BSIZE) != BSIZE || write(fd, "cc", 2) != 2){
+    printf(1, "overwrite test: overwrite failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("ow", 0);
+  if(read(fd, buf, 2*BSIZE) != 2*BSIZE){
+    printf(1, "overwrite test: read failed\n");
+    exit();
+  }
+  close(fd);
+  for(i = 0; i < 2*BSIZE; i++){
+    if(buf[i] != (i < BSIZE ? 'b' : i < BSIZE+2 ? 'c' : 'a')){
+      printf(1, "overwrite test: wrong data at %d\n", i);
+      exit();
+    }
+  }
+  unlink("ow");
+  printf(1, "overwrite test ok\n");
+}
+
 void
 mem(void)
 {
@@ -1285,7 +1943,7 @@ forktest(void)
 
   printf(1, "fork test\n");
 
-  for(n=0; n<1000; n++){
+  for(n=0; n<NPROC+1; n++){
     pid = fork();
     if(pid < 0)
       break;
@@ -1293,8 +1951,8 @@ forktest(void)
       exit();
   }
   
-  if(n == 1000){
-    printf(1, "fork claimed to work 1000 times!\n");
+  if(n == NPROC+1){
+    printf(1, "fork claimed to work %d times!\n", n);
     exit();
   }
   
@@ -1632,6 +2290,19 @@ main(int argc, char *argv[])
   pipe1();
   preempt();
   exitwait();
+  nanosleeptest();
+  sleepwheeltest();
+  threadtest();
+  mutextest();
+  affinitytest();
+  procstattest();
+  edftest();
+  lockstattest();
+  kmutextest();
+  bcachetest();
+  readaheadtest();
+  synctest();
+  overwritetest();
 
   rmdot();
   fourteen();
@@ -117,6 +117,15 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and halt until the next one arrives.
+// sti takes effect only after the following instruction,
+// so no interrupt can slip in between the sti and the hlt.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt");
+}
+
 static inline uint
 xchg(volatile uint *addr, uint newval)
 {
@@ -130,6 +139,57 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Atomically: if *addr == old, set it to newval.
+// Returns the previous value of *addr.
+static inline uint
+cmpxchg(volatile uint *addr, uint old, uint newval)
+{
+  uint result;
+
+  asm volatile("lock; cmpxchgl %2, %1" :
+               "=a" (result), "+m" (*addr) :
+               "r" (newval), "0" (old) :
+               "cc");
+  return result;
+}
+
+// Atomically add n to *addr.
+// Returns the previous value of *addr.
+static inline uint
+xadd(volatile uint *addr, uint n)
+{
+  asm volatile("lock; xaddl %0, %1" :
+               "+r" (n), "+m" (*addr) :
+               :
+               "cc");
+  return n;
+}
+
+// Tell the CPU it is in a spin loop.
+static inline void
+pause(void)
+{
+  asm volatile("pause" : : : "memory");
+}
+
+static inline uint64
+rdtsc(void)
+{
+  uint64 tsc;
+  asm volatile("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+// Divide n by d with a single divl, avoiding libgcc's 64-bit
+// division.  The quotient must fit in 32 bits.
+static inline uint
+divl(uint64 n, uint d)
+{
+  uint q, r;
+  asm("divl %2" : "=a" (q), "=d" (r) : "rm" (d), "A" (n));
+  return q;
+}
+
 static inline uint
 rcr2(void)
 {
@@ -144,6 +204,14 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline uint
+rcr3(void)
+{
+  uint val;
+  asm volatile("movl %%cr3,%0" : "=r" (val));
+  return val;
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().